@@ -1,17 +1,78 @@
 #include "SST39SF020A.h"
+#include "stats.h"
+#include "health.h"
+#include <util/atomic.h>
+
+// CE line of each chip
+static const uint8_t chip_enable[4] = {CHIP_ENABLE, CHIP_ENABLE_1, CHIP_ENABLE_2, CHIP_ENABLE_3};
+
+// selected chips take every program and erase cycle, reads come from a single one
+static uint8_t write_enables = CHIP_ENABLE;
+static uint8_t read_enable = CHIP_ENABLE;
 
 // pin toggle functions
+#if SST_CHIPS == 1
+// a single compile time bit, each is one SBI/CBI on the port the UART shares
 static inline void chipEnable(void)
 {
     // set CE low
     CONTROL_LINES &= ~CHIP_ENABLE;
 }
 
+static inline void readEnable(void)
+{
+    CONTROL_LINES &= ~CHIP_ENABLE;
+}
+
+static inline void chipEnableOnly(uint8_t chip)
+{
+    (void)chip; // there is only the one
+    CONTROL_LINES &= ~CHIP_ENABLE;
+}
+
 static inline void chipDisable(void)
 {
     // set CE high
     CONTROL_LINES |= CHIP_ENABLE;
 }
+#else
+// masks known at run time make these a read-modify-write of the port, keep interrupts out of it
+static inline void chipEnable(void)
+{
+    // set CE low on every selected chip
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        CONTROL_LINES &= ~write_enables;
+    }
+}
+
+static inline void readEnable(void)
+{
+    // set CE low on the chip to read
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        CONTROL_LINES &= ~read_enable;
+    }
+}
+
+static inline void chipDisable(void)
+{
+    // set CE high on every chip
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        CONTROL_LINES |= CHIP_ENABLE_ALL;
+    }
+}
+
+// CE low on one chip only
+static inline void chipEnableOnly(uint8_t chip)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        CONTROL_LINES = (CONTROL_LINES | CHIP_ENABLE_ALL) & ~chip_enable[chip];
+    }
+}
+#endif
 
 static inline void outputEnable(void)
 {
@@ -37,6 +98,37 @@ static inline void writeDisable(void)
     CONTROL_LINES |= WRITE_ENABLE;
 }
 
+// drive A16-17, bits = (address >> 16) & 0x03
+#if SST_PINMAP == SST_PINMAP_SHARED
+static inline void setAddressHigh2(uint_fast8_t bits)
+{
+    // PORTD also carries CE/OE/WE and the UART, so set each line on its own (SBI/CBI) instead of a read-modify-write of the port
+    if (bits & 0x01)
+    {
+        ADDR_HIGH2 |= ADDR_A16;
+    }
+    else
+    {
+        ADDR_HIGH2 &= (uint8_t)~ADDR_A16;
+    }
+
+    if (bits & 0x02)
+    {
+        ADDR_HIGH2 |= ADDR_A17;
+    }
+    else
+    {
+        ADDR_HIGH2 &= (uint8_t)~ADDR_A17;
+    }
+}
+#else
+static inline void setAddressHigh2(uint_fast8_t bits)
+{
+    // nothing else lives on this port, a whole port write is enough
+    ADDR_HIGH2 = bits;
+}
+#endif
+
 // control the data bus
 static inline void dataBusWrite(uint_fast8_t data)
 {
@@ -49,8 +141,7 @@ static inline void busClear(void)
     DATA_BUS_WRITE = 0x00;
     ADDR_LOW = 0x00;
     ADDR_HIGH = 0x00;
-
-    ADDR_HIGH2 = ADDR_HIGH2 & ~(ADDR_A16 | ADDR_A17);
+    setAddressHigh2(0);
 }
 
 static inline void dataBusDirIn(void)
@@ -70,10 +161,11 @@ static inline void dataBusDirOut(void)
 // Perform 1st 3 bus write sequences (common for write, sector erase, chip erase, software ID mode)
 static inline void startSoftwareModeSequence(uint_fast8_t data)
 {
-    ADDR_HIGH2 &= ~(ADDR_A16 | ADDR_A17); //Most significant address bits are not needed yet
+    setAddressHigh2(0); //Most significant address bits are not needed yet
 
-    chipEnable();
+    // OE goes high first, with several chips selected they would all drive the data bus
     outputDisable();
+    chipEnable();
 
     // 1st bus write cycle
     ADDR_LOW = 0x55;
@@ -111,7 +203,12 @@ void SST39SF020A_init_pins(void)
     DDRA = 0xff; // Address low pins are outputs
     DDRC = 0xff; // Address high pins are outputs
     dataBusDirIn(); // read mode is default
-    DDRD = 0xf8; // Additional address pins and control pins are outputs, pins PD0-1 used for UART, PD2 unused
+#if SST_PINMAP == SST_PINMAP_SHARED
+    DDRD = 0xf8 | CHIP_ENABLE_ALL; // Additional address pins and control pins are outputs, pins PD0-1 used for UART, PD2 unless it is a CE
+#else
+    DDRD = CHIP_ENABLE_ALL | OUTPUT_ENABLE | WRITE_ENABLE; // control pins are outputs, pins PD0-1 used for UART
+    ADDR_HIGH2_DIR = ADDR_A16 | ADDR_A17; // Additional address pins are outputs
+#endif
 
     //default to standby
     chipDisable();
@@ -160,26 +257,103 @@ void SST39SF020A_setWriteEnable(int status)
 }
 
 
+uint8_t SST39SF020A_select(uint8_t chips)
+{
+    if (!chips || (chips & ~SST_CHIPS_ALL))
+    {
+        return 0;
+    }
+
+    write_enables = 0;
+    for (uint8_t i = SST_CHIPS; i--; )
+    {
+        if (chips & (1 << i))
+        {
+            write_enables |= chip_enable[i];
+            read_enable = chip_enable[i]; // ends on the lowest
+        }
+    }
+
+    return 1;
+}
+
+
+/* Poll DQ7 until it shows the programmed data again, 0 after SST_PROGRAM_TIMEOUT_US.
+   Untimed so it can sit inside a measurement, the bound only reads the low half of the timer */
+static inline uint8_t pollData(uint_fast8_t data)
+{
+    data &= DATA_POLL_BIT;
+
+    dataBusDirIn();
+
+    // Compare if DQ7 is the complement of the actual data. The deadline is taken before the read,
+    // so a poll held up by an interrupt still gets one look at the finished chip
+    const uint16_t start = TCNT1;
+    while (1)
+    {
+        const uint8_t late = (uint16_t)(TCNT1 - start) > TIMER_US_TO_TICKS(SST_PROGRAM_TIMEOUT_US);
+
+        outputEnable();
+        const uint_fast8_t read = DATA_BUS_READ & DATA_POLL_BIT;
+        outputDisable();
+
+        if (data == read)
+        {
+            return 1;
+        }
+        if (late)
+        {
+            return 0;
+        }
+    }
+}
+
+/* The selected chips program or erase in parallel, wait for each in turn as only one may drive the data bus.
+   Programs poll DQ7 with pollData, erases use the toggle bit. Every chip is waited for even if one times out,
+   returns 0 if any did */
+static uint8_t waitForSelected(uint_fast8_t data, uint8_t program, uint32_t timeout_us)
+{
+    uint8_t ok = 1;
+
+    for (uint8_t i = 0; i < SST_CHIPS; i++)
+    {
+        if (write_enables & chip_enable[i])
+        {
+            chipEnableOnly(i);
+
+            if (program)
+            {
+                ok &= pollData(data);
+            }
+            else
+            {
+                ok &= waitForToggleBit(timeout_us);
+            }
+        }
+    }
+
+    return ok;
+}
+
+
 // function to read from an address
 uint8_t SST39SF020A_readData(uint32_t address)
 {
-    busClear();
-
-    address &= ADDR_MASK; //18bit address space
+    STATS_START(start);
 
+    // every address line is driven below, no need to clear the bus first
     const uint8_t addr_low = (uint8_t)(address & 0x00ff);
     const uint8_t addr_high = (uint8_t)((address & 0xff00) >> 8);
-    const uint8_t addr_high2 = (uint8_t)((address & 0x30000) >> 10);
+    const uint8_t addr_high2 = (uint8_t)((address >> 16) & 0x03); //18bit address space
 
     dataBusDirIn();
     writeDisable();
 
     ADDR_LOW = addr_low;
     ADDR_HIGH = addr_high;
-    ADDR_HIGH2 &= ~(ADDR_A16 | ADDR_A17);
-    ADDR_HIGH2 |= addr_high2;
+    setAddressHigh2(addr_high2);
 
-    chipEnable();
+    readEnable();
     outputEnable();
 
     // account for propagation delay
@@ -192,10 +366,60 @@ uint8_t SST39SF020A_readData(uint32_t address)
     chipDisable();
     outputDisable();
 
+    STATS_RECORD(STAT_READ, start);
+
     return result;
 }
 
 
+// read consecutive addresses, only the address lines that change are updated
+void SST39SF020A_readBlock(uint32_t address, uint8_t* buf, uint16_t length)
+{
+    STATS_START(start);
+
+    uint8_t addr_low = (uint8_t)(address & 0x00ff);
+    uint8_t addr_high = (uint8_t)((address & 0xff00) >> 8);
+    uint8_t addr_high2 = (uint8_t)((address >> 16) & 0x03); //18bit address space
+
+    dataBusDirIn();
+    writeDisable();
+
+    ADDR_HIGH = addr_high;
+    setAddressHigh2(addr_high2);
+
+    // CE and OE stay low for the whole block, each new address starts the next read cycle
+    readEnable();
+    outputEnable();
+
+    while (length--)
+    {
+        ADDR_LOW = addr_low;
+
+        // address access time is 70ns max, a nop is 83ns at 12MHz
+        CLOCK_DELAY;
+        CLOCK_DELAY;
+        CLOCK_DELAY;
+
+        *buf++ = DATA_BUS_READ;
+
+        if (++addr_low == 0)
+        {
+            if (++addr_high == 0)
+            {
+                addr_high2 = (addr_high2 + 1) & 0x03;
+                setAddressHigh2(addr_high2);
+            }
+            ADDR_HIGH = addr_high;
+        }
+    }
+
+    chipDisable();
+    outputDisable();
+
+    STATS_RECORD(STAT_READ, start);
+}
+
+
 uint8_t SST39SF020A_readManufacturerID(void)
 {
     return 0xbf;
@@ -222,7 +446,7 @@ uint8_t SST39SF020A_readDeviceID(void)
     CLOCK_DELAY;
 
     outputEnable();
-    chipEnable();
+    readEnable();
 
     uint8_t result = DATA_BUS_READ;
     //SST39SF020A should always return 0xb6
@@ -240,8 +464,10 @@ uint8_t SST39SF020A_readDeviceID(void)
 }
 
 
-void SST39SF020A_writeData(uint32_t address, uint8_t data)
+uint8_t SST39SF020A_writeData(uint32_t address, uint8_t data)
 {
+    STATS_START(start);
+
     // prepare the address. These calculations are slow on a dumb 8bit micro-controller.
     address &= ADDR_MASK; //18bit address space
 
@@ -249,56 +475,58 @@ void SST39SF020A_writeData(uint32_t address, uint8_t data)
     const uint8_t addr_low = (uint8_t)(address & 0x00ff);
     const uint8_t addr_high = (uint8_t)((address & 0xff00) >> 8);
 
-    uint8_t addr_high2 = (uint8_t)((address & 0x30000) >> 10);
-    addr_high2 |= OUTPUT_ENABLE;
-    addr_high2 &= ~(CHIP_ENABLE | WRITE_ENABLE);
-    // when the most significant bits of the address are used, WE is low, CE is low and OE is high
+    const uint8_t addr_high2 = (uint8_t)(address >> 16);
 
-    // prepare to write to the ROM
+    // prepare to write to the ROM, the command sequence drives every address line so the bus needs no clearing
     dataBusDirOut();
-    busClear();
 
     startSoftwareModeSequence(BUS_CMD_WRITE);
 
-    // 4th bus write cycle, programs the byte
+    // 4th bus write cycle, programs the byte. CE is still low and OE high from the command sequence
     ADDR_LOW = addr_low;
     ADDR_HIGH = addr_high;
-    ADDR_HIGH2 = addr_high2; //its a bit awkward here as the same GPIO (PORTD) is shared with control pins
+    setAddressHigh2(addr_high2);
     CLOCK_DELAY;
     CLOCK_DELAY;
     CLOCK_DELAY;
     writeEnable(); //latch the address
     dataBusWrite(data);
     writeDisable(); //latch the data
+    const uint32_t program_start = timer_now();
 
-    CLOCK_DELAY;
-    CLOCK_DELAY;
-    outputEnable();
-
+    // Wait for byte program operation to complete (should take 20us), only the raw poll is timed
+    const uint8_t ok = waitForSelected(data, TRUE, SST_PROGRAM_TIMEOUT_US);
 
-    // Wait for byte program operation to complete (should take 20us)
-    delay_us(15);
-    waitForToggleBit();
-    waitForDataPoll(data);
+    if (ok)
+    {
+        health_recordProgram(address, timer_now() - program_start);
+    }
+    else
+    {
+        health_recordProgramTimeout(address);
+    }
+    STATS_RECORD(STAT_DATA_POLL, program_start);
 
     chipDisable();
 
     busClear();
+
+    STATS_RECORD(STAT_PROGRAM, start);
+
+    return ok;
 }
 
-void SST39SF020A_sectorErase(uint8_t sector)
+uint8_t SST39SF020A_sectorErase(uint8_t sector)
 {
+    STATS_START(start);
+
     // prepare the address to fill with sector to erase
     sector &= 0x3f; //6bit address (A17-A12)
     const uint8_t sector_low = ((sector & 0x0f) << 4);
-    uint8_t sector_high = ((sector & 0x30) << 2);
-    sector_high |= OUTPUT_ENABLE;
-    sector_high &= ~(CHIP_ENABLE | WRITE_ENABLE);
-    // when the most significant bits of the address are to be used, WE is low, CE is low and OE is high
+    const uint8_t sector_high = (sector >> 4);
 
 
     dataBusDirOut();
-    busClear();
 
     startSoftwareModeSequence(BUS_CMD_ERASE);
 
@@ -327,32 +555,36 @@ void SST39SF020A_sectorErase(uint8_t sector)
     // 6th bus cycle
     ADDR_LOW = 0x00;
     ADDR_HIGH = sector_low;
-    ADDR_HIGH2 = sector_high;
+    setAddressHigh2(sector_high);
     CLOCK_DELAY;
     CLOCK_DELAY;
     CLOCK_DELAY;
     writeEnable(); //latch the address
     dataBusWrite(0x30);
     writeDisable(); //latch the data
-
-    //delay_us(1);
-    CLOCK_DELAY;
-    CLOCK_DELAY;
-    outputEnable();
+    const uint32_t erase_start = timer_now();
 
     // Wait for sector erase to complete (should take 25ms)
     delay_ms(20);
-    waitForToggleBit();
+    const uint8_t ok = waitForSelected(0, FALSE, SST_SECTOR_ERASE_TIMEOUT_US);
+
+    // a timed out erase saturates the recorded time
+    health_recordErase(sector, timer_now() - erase_start);
 
     chipDisable();
 
     busClear();
+
+    STATS_RECORD(STAT_SECTOR_ERASE, start);
+
+    return ok;
 }
 
-void SST39SF020A_chipErase(void)
+uint8_t SST39SF020A_chipErase(void)
 {
+    STATS_START(start);
+
     dataBusDirOut();
-    busClear();
 
     startSoftwareModeSequence(BUS_CMD_ERASE);
 
@@ -388,28 +620,39 @@ void SST39SF020A_chipErase(void)
     CLOCK_DELAY;
     writeDisable(); //latch the data
 
-    //delay_us(1);
-    CLOCK_DELAY;
-    CLOCK_DELAY;
-    outputEnable();
-
     // wait for chip erase to complete (should take 100ms)
     delay_ms(95);
-    waitForToggleBit();
+    const uint8_t ok = waitForSelected(0, FALSE, SST_CHIP_ERASE_TIMEOUT_US);
 
     chipDisable();
 
     busClear();
+
+    STATS_RECORD(STAT_CHIP_ERASE, start);
+
+    return ok;
 }
 
-void waitForToggleBit(void)
+uint8_t waitForToggleBit(uint32_t timeout_us)
 {
+    const uint32_t poll_start = timer_now();
+    STATS_START(start);
+
     dataBusDirIn();
 
     // Compare consecutive toggle bit reads. They will alternate if still erasing.
     uint_fast8_t last, curr = 0;
+    uint8_t late = 0;
     do
     {
+        // as in pollData, give up only when a read after the deadline still toggles
+        if (late)
+        {
+            STATS_RECORD(STAT_TOGGLE_BIT, start);
+            return 0;
+        }
+        late = timer_now() - poll_start > TIMER_US_TO_TICKS(timeout_us);
+
         outputEnable();
         last = DATA_BUS_READ & ~TOGGLE_BIT;
         outputDisable();
@@ -423,25 +666,22 @@ void waitForToggleBit(void)
     }
     while (last != curr);
 
+    STATS_RECORD(STAT_TOGGLE_BIT, start);
+
     // The erase has completed after 25ms for sector or 100ms for chip
+    return 1;
 }
 
 /* Wait using data poll
     read data should be 0 during erase, 1 when done.
     or read data is complement of actual data when programming byte */
-void waitForDataPoll(uint_fast8_t data)
+uint8_t waitForDataPoll(uint_fast8_t data)
 {
-    data &= DATA_POLL_BIT;
+    STATS_START(start);
 
-    dataBusDirIn();
+    const uint8_t ok = pollData(data);
 
-    // Compare if DQ7 is the complement of the actual data
-    uint_fast8_t read = 0;
-    do
-    {
-        outputEnable();
-        read = DATA_BUS_READ & DATA_POLL_BIT;
-        outputDisable();
-    }
-    while (data != read);
+    STATS_RECORD(STAT_DATA_POLL, start);
+
+    return ok;
 }
@@ -3,12 +3,38 @@
 
 #include "atmega.h"
 
+// Wiring profiles, pick one at compile time with -DSST_PINMAP=...
+#define SST_PINMAP_SHARED 0 // A16-17 on PD6-7, sharing PORTD with the control lines and the UART
+#define SST_PINMAP_DEDICATED 1 // A16-17 on bits 0-1 of a port of their own
+
+#ifndef SST_PINMAP
+#define SST_PINMAP SST_PINMAP_SHARED
+#endif
+
 // EEPROM chip address bus (18bit)
 #define ADDR_LOW PORTA //low 8bits A0-7
 #define ADDR_HIGH PORTC //high 8bit A8-15
+
+#if SST_PINMAP == SST_PINMAP_SHARED
 #define ADDR_HIGH2 PORTD //highest 2bits A16-17
+#define ADDR_HIGH2_DIR DDRD
 #define ADDR_A16 (1<<6)
 #define ADDR_A17 (1<<7)
+#elif SST_PINMAP == SST_PINMAP_DEDICATED
+/* The ATmega32 has no spare port. The ATmega64/128 default to PORTF (PF0-1, ADC0-1), PORTE would put A16-17
+   on RXD0/TXD0. Override with -DADDR_HIGH2=... -DADDR_HIGH2_DIR=..., the whole port is written */
+#ifndef ADDR_HIGH2
+#ifndef PORTF
+#error "SST_PINMAP_DEDICATED needs a spare port, define ADDR_HIGH2 and ADDR_HIGH2_DIR"
+#endif
+#define ADDR_HIGH2 PORTF
+#define ADDR_HIGH2_DIR DDRF
+#endif
+#define ADDR_A16 (1<<0)
+#define ADDR_A17 (1<<1)
+#else
+#error "Unknown SST_PINMAP"
+#endif
 
 #define ADDR_MASK (0x3ffff)
 
@@ -24,6 +50,26 @@
 #define WRITE_ENABLE (1<<3)// Write enable - PD3
 #define CONTROL_LINES PORTD
 
+/* Gang programming: up to SST_CHIPS chips share the address, data, OE and WE lines and each has its own CE on PORTD.
+   Chip 0 is on CHIP_ENABLE, chip 1 on the spare PD2, chips 2-3 on PD6-7 where A16-17 have moved off PORTD. */
+#ifndef SST_CHIPS
+#define SST_CHIPS 1
+#endif
+
+#define CHIP_ENABLE_1 (1<<2) // PD2
+#define CHIP_ENABLE_2 (1<<6) // PD6
+#define CHIP_ENABLE_3 (1<<7) // PD7
+
+#if SST_CHIPS < 1 || SST_CHIPS > 4 || (SST_PINMAP == SST_PINMAP_SHARED && SST_CHIPS > 2)
+#error "Unsupported SST_CHIPS for this SST_PINMAP"
+#endif
+
+#define SST_CHIPS_ALL ((uint8_t)((1 << SST_CHIPS) - 1))
+
+// CE lines of every chip fitted
+#define CHIP_ENABLE_ALL (CHIP_ENABLE | (SST_CHIPS > 1 ? CHIP_ENABLE_1 : 0) | \
+                         (SST_CHIPS > 2 ? CHIP_ENABLE_2 : 0) | (SST_CHIPS > 3 ? CHIP_ENABLE_3 : 0))
+
 // Flash/write verification mode bits
 #define TOGGLE_BIT (1<<6)
 #define DATA_POLL_BIT (1<<7)
@@ -45,23 +91,34 @@ void SST39SF020A_setChipEnable(int status);
 void SST39SF020A_setOutputEnable(int status);
 void SST39SF020A_setWriteEnable(int status);
 
+/* Select chips by mask, bit n is chip n. Programs and erases go to all selected chips at once,
+   reads come from the lowest one as only one chip may drive the data bus. Returns 0 for an invalid mask. */
+uint8_t SST39SF020A_select(uint8_t chips);
+
 // Read
 uint8_t SST39SF020A_readData(uint32_t address);
+void SST39SF020A_readBlock(uint32_t address, uint8_t* buf, uint16_t length);
 
 // Information
 uint8_t SST39SF020A_readManufacturerID(void);
 uint8_t SST39SF020A_readDeviceID(void);
 
-// Program
-void SST39SF020A_writeData(uint32_t address, uint8_t data);
-void SST39SF020A_sectorErase(uint8_t sector);
-void SST39SF020A_chipErase(void);
+/* Program, each returns 0 if a selected chip didn't finish within its timeout (a worn cell, or a chip
+   missing from the gang mask), 1 otherwise */
+#define SST_PROGRAM_TIMEOUT_US 1000UL // 50 times the datasheet maximum
+#define SST_SECTOR_ERASE_TIMEOUT_US 100000UL // past the fixed 20ms wait, 4 times the maximum
+#define SST_CHIP_ERASE_TIMEOUT_US 400000UL // past the fixed 95ms wait, 4 times the maximum
+
+uint8_t SST39SF020A_writeData(uint32_t address, uint8_t data);
+uint8_t SST39SF020A_sectorErase(uint8_t sector);
+uint8_t SST39SF020A_chipErase(void);
 
-// Verify
-void waitForToggleBit(void);
-void waitForDataPoll(uint_fast8_t data);
+// Verify, 0 if the chip was still busy after timeout_us
+uint8_t waitForToggleBit(uint32_t timeout_us);
+uint8_t waitForDataPoll(uint_fast8_t data);
 
 #define SST39SF020A_NUMSECTORS 64
+#define SST39SF020A_SECTORSIZE 0x1000
 
 #endif // SST39SF020A_H_INCLUDED
 
@@ -1,4 +1,5 @@
 #include "atmega.h"
+#include "stats.h"
 #include <avr/interrupt.h>
 
 // microsecond delay
@@ -35,11 +36,50 @@ void delay_ms(unsigned int time)
 }
 
 
+// high half of the timestamp
+static volatile uint16_t timer_overflows = 0;
+
+void timer_init(void)
+{
+    TCCR1A = 0x00; // normal mode
+    TCCR1B = (1<<CS11); // clk/8
+    TIMSK |= (1<<TOIE1); // count overflows
+    sei();
+}
+
+uint32_t timer_now(void)
+{
+    const uint8_t sreg = SREG;
+    cli();
+
+    uint16_t high = timer_overflows;
+    const uint16_t low = TCNT1;
+
+    // an overflow that happened after interrupts were disabled has not been counted yet
+    if ((TIFR & (1<<TOV1)) && low < 0x8000)
+    {
+        high++;
+    }
+
+    SREG = sreg;
+
+    return ((uint32_t)high << 16) | low;
+}
+
+ISR(TIMER1_OVF_vect)
+{
+    timer_overflows++;
+}
+
 // configure the UART hardware
 void UART_setup(uint32_t baudrate)
 {
     /* Set frame format: 8data, 1stop bit  */
+    #ifdef URSEL
     UCSRC = (1<<URSEL)|(3<<UCSZ0);
+    #else
+    UCSRC = (3<<UCSZ0); // no register sharing with UBRRH
+    #endif
 
     //set the baud rate
     UBRRL = BAUDRATE_LOW(baudrate);
@@ -58,25 +98,53 @@ void UART_setup(uint32_t baudrate)
 static inline void UART_Transmit(unsigned char data)
 {
     /* Wait for empty transmit buffer */
-    while ( !( UCSRA & (1<<UDRE)) );
+    if ( !( UCSRA & (1<<UDRE)) )
+    {
+        STATS_START(start);
+        while ( !( UCSRA & (1<<UDRE)) );
+        STATS_RECORD(STAT_UART_TX, start);
+    }
 
     /* Put data into buffer, sends the data */
     UDR = data;
 }
 
+#ifdef USE_ISR
+// circular receive buffer filled by the RX interrupt, the 8bit indexes wrap with BUFFER_SIZE 256
+static volatile uint8_t rx_buffer[BUFFER_SIZE];
+static ISR_SHARED_UINT8 rx_head = 0;
+static ISR_SHARED_UINT8 rx_tail = 0;
+
+#define UART_DATA_READY (rx_head != rx_tail)
+#else
+#define UART_DATA_READY (UCSRA & (1<<RXC))
+#endif // USE_ISR
+
 static inline unsigned char UART_Receive(void)
 {
     /* Wait for data to be received */
-    while ( !(UCSRA & (1<<RXC)) );
+    if ( !UART_DATA_READY )
+    {
+        STATS_START(start);
+        while ( !UART_DATA_READY );
+        STATS_RECORD(STAT_UART_RX, start);
+    }
 
     /* Get and return received data from buffer */
+    #ifdef USE_ISR
+    const unsigned char data = rx_buffer[rx_tail];
+    rx_tail++;
+    return data;
+    #else
     return UDR;
+    #endif // USE_ISR
 }
 
 
 // helper for printf
 int put_char(char c, FILE* stream)
 {
+    (void)stream; // there is only the one
     UART_Transmit(c);
 
     return 0;
@@ -84,6 +152,36 @@ int put_char(char c, FILE* stream)
 
 
 
+// idle until the next command starts arriving, so the wait isn't counted as a UART stall
+void UART_waitForData(void)
+{
+    while ( !UART_DATA_READY );
+}
+
+// text input is echoed back to the PC unless turned off
+static uint8_t echo = 1;
+
+void UART_setEcho(uint8_t on)
+{
+    echo = on;
+}
+
+// echo a character that was read raw, once it's known to be text
+void UART_echo(char c)
+{
+    if (echo)
+    {
+        UART_Transmit(c);
+    }
+}
+
+char UART_readChar(void)
+{
+    const char data = UART_Receive();
+    UART_echo(data);
+    return data;
+}
+
 // my own fgets like function (read up to maxlength bytes from the circular buffer)
 // length = number of expected chars + null terminator
 void UART_readString(char* buf, uint8_t length)
@@ -94,10 +192,9 @@ void UART_readString(char* buf, uint8_t length)
 
     for (uint8_t i = 0; i < length; i++)
     {
-        data = UART_Receive();
-        UART_Transmit(data); //echo back to PC
+        data = UART_readChar();
 
-        if (data < 0x20)// || data > 0x7e)
+        if ((uint8_t)data < 0x20)// || data > 0x7e)
         {
             // The first invalid char will terminate the string early
             break;
@@ -111,11 +208,35 @@ void UART_readString(char* buf, uint8_t length)
     *cur = 0;
 }
 
+// read exactly length bytes, nothing is echoed
+void UART_read(uint8_t* buf, uint16_t length)
+{
+    while (length--)
+    {
+        *buf++ = UART_Receive();
+    }
+}
+
+void UART_write(const uint8_t* buf, uint16_t length)
+{
+    while (length--)
+    {
+        UART_Transmit(*buf++);
+    }
+}
+
 // interrupt handler
 #ifdef USE_ISR
 ISR(USART_RXC_vect)
 {
-    uint8_t data = UART_Receive();
-    UART_Transmit(data); //echo back to PC
+    const uint8_t data = UDR;
+    const uint8_t next = rx_head + 1;
+
+    // drop the byte if the buffer is full, the host keeps its send window below BUFFER_SIZE
+    if (next != rx_tail)
+    {
+        rx_buffer[rx_head] = data;
+        rx_head = next;
+    }
 }
 #endif // USE_ISR
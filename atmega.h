@@ -7,6 +7,23 @@
 
 #include <avr/io.h>
 
+// Parts with two USARTs (ATmega64/128, needed for SST_PINMAP_DEDICATED) talk on USART0 under the ATmega32 names
+#if !defined(UCSRA) && defined(UCSR0A)
+#define UCSRA UCSR0A
+#define UCSRB UCSR0B
+#define UCSRC UCSR0C
+#define UBRRL UBRR0L
+#define UBRRH UBRR0H
+#define UDR UDR0
+#define RXC RXC0
+#define UDRE UDRE0
+#define RXEN RXEN0
+#define TXEN TXEN0
+#define RXCIE RXCIE0
+#define UCSZ0 UCSZ00
+#define USART_RXC_vect USART0_RX_vect
+#endif
+
 // Serial port baud rate
 #define BAUD 57600
 
@@ -19,22 +36,57 @@ void delay_ms(unsigned int time);
 
 #define CLOCK_DELAY __asm__("nop")
 
+// Free running timestamp from Timer1 (clk/8), extended to 32bit by the overflow interrupt
+#define TIMER_PRESCALER 8UL
+void timer_init(void);
+uint32_t timer_now(void);
+
+// microseconds per tick in 16.16 fixed point, so converting is a 32bit multiply and shift
+#define TIMER_US_PER_TICK_Q16 ((TIMER_PRESCALER * 65536UL + (F_CPU) / 2000000UL) / ((F_CPU) / 1000000UL))
+#if TIMER_US_PER_TICK_Q16 >= 65536UL
+#error "timer_ticksToUs needs a tick shorter than 1us"
+#endif
+
+#define TIMER_US_TO_TICKS(us) ((uint32_t)(us) * ((F_CPU) / 1000000UL) / TIMER_PRESCALER)
+
+static inline uint32_t timer_ticksToUs(uint32_t ticks)
+{
+    // in two halves, neither product overflows
+    return (ticks >> 16) * TIMER_US_PER_TICK_Q16 + (((ticks & 0xffff) * TIMER_US_PER_TICK_Q16) >> 16);
+}
+
 void UART_setup(uint32_t baudrate);
 //void UART_Transmit(unsigned char data);
 //unsigned char UART_Receive(void);
 
 #ifdef USE_ISR
+#include <avr/interrupt.h>
 ISR(USART_RXC_vect);
 #endif
 
+// type of the byte sized variables shared with interrupt handlers, the host emulator swaps in an atomic
+#ifndef ISR_SHARED_UINT8
+#define ISR_SHARED_UINT8 volatile uint8_t
+#endif
+
 // for printf functions
 #include <stdio.h>
 int put_char(char c, FILE *stream);
 
 
-// serial reading
+// serial reading, size of the receive buffer when USE_ISR is defined (indexes are 8bit)
 #define BUFFER_SIZE 256
 void UART_readString(char* buf, uint8_t maxlength);
+void UART_waitForData(void);
+
+// text input, echoed unless UART_setEcho(0)
+char UART_readChar(void);
+void UART_echo(char c);
+void UART_setEcho(uint8_t on);
+
+// raw binary transfers, no echo or terminator handling
+void UART_read(uint8_t* buf, uint16_t length);
+void UART_write(const uint8_t* buf, uint16_t length);
 
 #endif // ATMEGA_H_INCLUDED
 
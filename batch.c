@@ -0,0 +1,273 @@
+#include "batch.h"
+#include "atmega.h"
+#include "SST39SF020A.h"
+#include "protocol.h"
+
+#define OP_CHIP_ERASE 'f'
+#define OP_SECTOR_ERASE 's'
+#define OP_WRITE 'w'
+#define OP_CRC 'c'
+#define OP_CHIP_SELECT 'e'
+#define OP_COPY 'y'
+#define OP_FILL 't'
+
+#define CMD_BATCH 'b'
+
+uint16_t flash_crc(uint32_t start, uint32_t length)
+{
+    uint16_t crc = FRAME_CRC_INIT;
+    uint8_t buf[32];
+
+    // prevent this going outside of the maximum address
+    if (start > ADDR_MASK)
+    {
+        return crc;
+    }
+    if (length > ADDR_MASK + 1 - start)
+    {
+        length = ADDR_MASK + 1 - start;
+    }
+
+    while (length)
+    {
+        const uint8_t chunk = (length < sizeof(buf)) ? length : sizeof(buf);
+        SST39SF020A_readBlock(start, buf, chunk);
+        crc = crc_update(crc, buf, chunk);
+
+        start += chunk;
+        length -= chunk;
+    }
+
+    return crc;
+}
+
+// program one byte, programming can only clear bits so writing 0xff never changes the chip. 0 on a timeout
+static inline uint8_t program(uint32_t addr, uint8_t data)
+{
+    return data == 0xff || SST39SF020A_writeData(addr, data);
+}
+
+// copy a sector through SRAM, the crc of the source as it was read is checked against the copy
+static uint8_t sector_copy(uint8_t src, uint8_t dst, uint16_t* crc)
+{
+    uint8_t buf[32];
+    const uint32_t from = (uint32_t)src * SST39SF020A_SECTORSIZE;
+    const uint32_t to = (uint32_t)dst * SST39SF020A_SECTORSIZE;
+    uint16_t expected = FRAME_CRC_INIT;
+
+    for (uint16_t offset = 0; offset < SST39SF020A_SECTORSIZE; offset += sizeof(buf))
+    {
+        SST39SF020A_readBlock(from + offset, buf, sizeof(buf));
+        expected = crc_update(expected, buf, sizeof(buf));
+
+        for (uint8_t i = 0; i < sizeof(buf); i++)
+        {
+            if (!program(to + offset + i, buf[i]))
+            {
+                *crc = 0;
+                return BATCH_STATUS_ERROR;
+            }
+        }
+    }
+
+    *crc = flash_crc(to, SST39SF020A_SECTORSIZE);
+    return (*crc == expected) ? BATCH_STATUS_OK : BATCH_STATUS_ERROR;
+}
+
+// fill a range with a test pattern generated on the fly, see FILL_* in protocol.h
+static uint8_t fill(uint32_t addr, uint32_t length, uint8_t pattern, uint8_t seed, uint16_t* crc)
+{
+    if (pattern > FILL_RANDOM || addr > ADDR_MASK || length > ADDR_MASK + 1 - addr)
+    {
+        return BATCH_STATUS_ERROR;
+    }
+
+    uint16_t lfsr = 0xff00 | seed;
+    uint16_t expected = FRAME_CRC_INIT;
+    uint8_t data = seed;
+
+    for (uint32_t n = 0; n < length; n++)
+    {
+        if (pattern == FILL_INCREMENT)
+        {
+            data = seed + (uint8_t)n;
+        }
+        else if (pattern == FILL_RANDOM)
+        {
+            lfsr = (lfsr >> 1) ^ ((lfsr & 1) ? 0xb400 : 0);
+            data = (uint8_t)lfsr;
+        }
+
+        expected = crc_update(expected, &data, 1);
+        if (!program(addr + n, data))
+        {
+            *crc = 0;
+            return BATCH_STATUS_ERROR;
+        }
+    }
+
+    *crc = flash_crc(addr, length);
+    return (*crc == expected) ? BATCH_STATUS_OK : BATCH_STATUS_ERROR;
+}
+
+static void sendResult(uint8_t op, uint8_t status, uint16_t value)
+{
+    const uint8_t result[BATCH_RESULT_SIZE] = {op, status, (uint8_t)(value >> 8), (uint8_t)value};
+    frame_write(result, sizeof(result));
+}
+
+static inline uint32_t read24(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 16) | ((uint16_t)p[1] << 8) | p[2];
+}
+
+// argument bytes after the op, 0xff for an unknown op
+static uint8_t record_size(uint8_t op)
+{
+    switch (op)
+    {
+        case OP_CHIP_ERASE: return 0;
+        case OP_SECTOR_ERASE: return 1;
+        case OP_CHIP_SELECT: return 1;
+        case OP_COPY: return 2;
+        case OP_WRITE: return 5;
+        case OP_CRC: return 6;
+        case OP_FILL: return 8;
+        default: return 0xff;
+    }
+}
+
+// drop what is left of the upload so it isn't taken for commands
+static void drain(uint16_t length)
+{
+    uint8_t byte;
+    while (length--)
+    {
+        UART_read(&byte, 1);
+    }
+}
+
+// records run as they arrive, the rest of the batch waits in the receive buffer
+void batch_run(uint16_t length)
+{
+    if (length > BATCH_MAX_SIZE)
+    {
+        drain(length);
+        printf("ERROR\n");
+        return;
+    }
+
+    frame_begin(CMD_BATCH);
+
+    uint8_t arg[8];
+    uint8_t buf[32];
+    uint16_t records = 0;
+
+    while (length)
+    {
+        uint8_t op;
+        UART_read(&op, 1);
+        length--;
+
+        const uint8_t size = record_size(op);
+        if (size > length)
+        {
+            // unknown or truncated record, the rest of the batch can't be trusted
+            drain(length);
+            sendResult(op, BATCH_STATUS_ERROR, 0);
+            break;
+        }
+        UART_read(arg, size);
+        length -= size;
+
+        uint8_t status = BATCH_STATUS_OK;
+        uint16_t value = 0;
+
+        if (op == OP_CHIP_ERASE)
+        {
+            if (!SST39SF020A_chipErase())
+            {
+                status = BATCH_STATUS_ERROR;
+            }
+        }
+        else if (op == OP_SECTOR_ERASE)
+        {
+            if (arg[0] >= SST39SF020A_NUMSECTORS)
+            {
+                drain(length);
+                sendResult(op, BATCH_STATUS_ERROR, 0);
+                break;
+            }
+            if (!SST39SF020A_sectorErase(arg[0]))
+            {
+                status = BATCH_STATUS_ERROR;
+            }
+        }
+        else if (op == OP_WRITE)
+        {
+            uint32_t addr = read24(arg);
+            uint16_t count = ((uint16_t)arg[3] << 8) | arg[4];
+
+            if (count > length)
+            {
+                drain(length);
+                sendResult(op, BATCH_STATUS_ERROR, 0);
+                break;
+            }
+            length -= count;
+
+            if (addr + count > ADDR_MASK + 1)
+            {
+                status = BATCH_STATUS_ERROR;
+            }
+
+            // program in pieces as the data comes in, after a timeout the rest is only drained
+            while (count)
+            {
+                const uint8_t chunk = (count < sizeof(buf)) ? count : sizeof(buf);
+                UART_read(buf, chunk);
+                for (uint8_t i = 0; status == BATCH_STATUS_OK && i < chunk; i++)
+                {
+                    if (!program(addr++, buf[i]))
+                    {
+                        status = BATCH_STATUS_ERROR;
+                    }
+                }
+                count -= chunk;
+            }
+        }
+        else if (op == OP_CHIP_SELECT)
+        {
+            if (!SST39SF020A_select(arg[0]))
+            {
+                status = BATCH_STATUS_ERROR;
+            }
+        }
+        else if (op == OP_COPY)
+        {
+            if (arg[0] < SST39SF020A_NUMSECTORS && arg[1] < SST39SF020A_NUMSECTORS && arg[0] != arg[1])
+            {
+                status = sector_copy(arg[0], arg[1], &value);
+            }
+            else
+            {
+                status = BATCH_STATUS_ERROR;
+            }
+        }
+        else if (op == OP_FILL)
+        {
+            status = fill(read24(arg), read24(arg + 3), arg[6], arg[7], &value);
+        }
+        else if (op == OP_CRC)
+        {
+            value = flash_crc(read24(arg), read24(arg + 3));
+        }
+
+        sendResult(op, status, value);
+        records++;
+    }
+
+    sendResult(BATCH_END, BATCH_STATUS_OK, records);
+
+    frame_end();
+}
@@ -0,0 +1,12 @@
+#ifndef BATCH_H_INCLUDED
+#define BATCH_H_INCLUDED
+
+#include <stdint.h>
+
+// Receive a batch of length bytes and run it, record layout is in protocol.h
+void batch_run(uint16_t length);
+
+// crc16 of a flash range, same checksum as the reply frames
+uint16_t flash_crc(uint32_t start, uint32_t length);
+
+#endif // BATCH_H_INCLUDED
@@ -0,0 +1,95 @@
+#include "command.h"
+#include "atmega.h"
+#include "hexdump.h"
+#include "protocol.h"
+
+// binary header, the arguments follow the command byte
+static void readHeader(struct command* cmd)
+{
+    uint8_t raw[COMMAND_HEADER_SIZE - 1];
+    UART_read(raw, sizeof(raw));
+
+    cmd->op = raw[0];
+    cmd->args = COMMAND_MAX_ARGS;
+    cmd->arg[0] = ((uint32_t)raw[1] << 16) | ((uint16_t)raw[2] << 8) | raw[3];
+    cmd->arg[1] = ((uint32_t)raw[4] << 16) | ((uint16_t)raw[5] << 8) | raw[6];
+}
+
+static void endArgument(struct command* cmd, uint32_t value, uint8_t length)
+{
+    if (!length)
+    {
+        return; // repeated spaces
+    }
+
+    if (cmd->args == COMMAND_MAX_ARGS)
+    {
+        cmd->error = 1;
+        return;
+    }
+
+    cmd->arg[cmd->args++] = value;
+}
+
+void command_read(struct command* cmd)
+{
+    cmd->op = 0;
+    cmd->args = 0;
+    cmd->error = 0;
+
+    // the first byte is read raw, a binary header must not be echoed
+    uint8_t first;
+    UART_read(&first, 1);
+
+    if (first == COMMAND_START)
+    {
+        readHeader(cmd);
+        return;
+    }
+
+    char c = (char)first;
+    UART_echo(c);
+
+    // text: the first character is the command, then space separated arguments up to a control character
+    uint32_t value = 0;
+    uint8_t length = 0; // characters in the current argument
+
+    while ((uint8_t)c >= 0x20)
+    {
+        if (!cmd->op)
+        {
+            if (c != ' ')
+            {
+                cmd->op = c;
+            }
+        }
+        else if (c == ' ')
+        {
+            endArgument(cmd, value, length);
+            value = 0;
+            length = 0;
+        }
+        else
+        {
+            const uint8_t nibble = hex_nibble(c);
+
+            if (length == 1 && value == 0 && (c | 0x20) == 'x')
+            {
+                // 0x prefix
+            }
+            else if (nibble > 0x0f || value > 0x0fffffff)
+            {
+                cmd->error = 1;
+            }
+            else
+            {
+                value = (value << 4) | nibble;
+            }
+            length++;
+        }
+
+        c = UART_readChar();
+    }
+
+    endArgument(cmd, value, length);
+}
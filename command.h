@@ -0,0 +1,22 @@
+#ifndef COMMAND_H_INCLUDED
+#define COMMAND_H_INCLUDED
+
+#include <stdint.h>
+
+#define COMMAND_MAX_ARGS 2
+
+/* A command as it arrived, either as a text line
+    c [arg0 [arg1]]\n
+   with hex arguments (optional 0x prefix), or as the binary header in protocol.h */
+struct command
+{
+    char op; // 0 for an empty line
+    uint8_t args; // number of arguments given
+    uint8_t error; // an argument wasn't a hex number, or there were too many
+    uint32_t arg[COMMAND_MAX_ARGS];
+};
+
+// Receive the next command, text is parsed as each character arrives
+void command_read(struct command* cmd);
+
+#endif // COMMAND_H_INCLUDED
@@ -0,0 +1,105 @@
+#include "health.h"
+#include "SST39SF020A.h"
+
+struct sector_health
+{
+    uint8_t program[HEALTH_BINS]; // relative counts, halved when one fills up
+    uint8_t erase_first; // first erase seen since reset, the baseline for this part
+    uint8_t erase_last;
+};
+
+static struct sector_health sectors[SST39SF020A_NUMSECTORS];
+
+void health_reset(void)
+{
+    for (uint8_t i = 0; i < SST39SF020A_NUMSECTORS; i++)
+    {
+        for (uint8_t bin = 0; bin < HEALTH_BINS; bin++)
+        {
+            sectors[i].program[bin] = 0;
+        }
+        sectors[i].erase_first = 0;
+        sectors[i].erase_last = 0;
+    }
+}
+
+static void countProgram(uint32_t address, uint8_t bin)
+{
+    struct sector_health* s = &sectors[(address & ADDR_MASK) >> 12];
+
+    // keep the shape of the histogram rather than saturating
+    if (s->program[bin] == UINT8_MAX)
+    {
+        for (uint8_t i = 0; i < HEALTH_BINS; i++)
+        {
+            s->program[i] >>= 1;
+        }
+    }
+    s->program[bin]++;
+}
+
+// ticks = time from latching the data until DQ7 matched on every selected chip
+void health_recordProgram(uint32_t address, uint32_t ticks)
+{
+    uint8_t bin = HEALTH_BIN_TIMEOUT - 1;
+    if (ticks <= TIMER_US_TO_TICKS(HEALTH_BIN0_US))
+    {
+        bin = 0;
+    }
+    else if (ticks <= TIMER_US_TO_TICKS(HEALTH_BIN1_US))
+    {
+        bin = 1;
+    }
+    else if (ticks <= TIMER_US_TO_TICKS(HEALTH_BIN2_US))
+    {
+        bin = 2;
+    }
+
+    countProgram(address, bin);
+}
+
+void health_recordProgramTimeout(uint32_t address)
+{
+    countProgram(address, HEALTH_BIN_TIMEOUT);
+}
+
+void health_recordErase(uint8_t sector, uint32_t ticks)
+{
+    struct sector_health* s = &sectors[sector & (SST39SF020A_NUMSECTORS - 1)];
+
+    uint32_t units = ticks / TIMER_US_TO_TICKS(HEALTH_ERASE_UNIT_US);
+    if (units > UINT8_MAX)
+    {
+        units = UINT8_MAX;
+    }
+    if (!units)
+    {
+        units = 1; // 0 means never erased
+    }
+
+    if (!s->erase_first)
+    {
+        s->erase_first = units;
+    }
+    s->erase_last = units;
+}
+
+/* one line per sector that has seen any activity:
+    sector bin0 bin1 bin2 bin3 timeouts first_erase_us last_erase_us, a timed out erase shows as 63750 */
+void health_report(void)
+{
+    for (uint8_t i = 0; i < SST39SF020A_NUMSECTORS; i++)
+    {
+        const struct sector_health* s = &sectors[i];
+
+        if (!(s->program[0] | s->program[1] | s->program[2] | s->program[3] | s->program[4] | s->erase_last))
+        {
+            continue;
+        }
+
+        printf("%u %u %u %u %u %u %lu %lu\n", i,
+               s->program[0], s->program[1], s->program[2], s->program[3], s->program[4],
+               (uint32_t)s->erase_first * HEALTH_ERASE_UNIT_US, (uint32_t)s->erase_last * HEALTH_ERASE_UNIT_US);
+    }
+    printf("DONE\n");
+}
@@ -0,0 +1,23 @@
+#ifndef HEALTH_H_INCLUDED
+#define HEALTH_H_INCLUDED
+
+#include "atmega.h"
+
+/* Byte program time histogram bins, upper limits in us. The last bin catches everything slower.
+   Times run from the data latch until DQ7 matches, raw polling only, plus about 2us for the timer reads. */
+#define HEALTH_BIN0_US 20 // within the datasheet limit (14us typical, 20us max)
+#define HEALTH_BIN1_US 30 // marginal
+#define HEALTH_BIN2_US 60
+#define HEALTH_BIN_TIMEOUT 4 // gave up after SST_PROGRAM_TIMEOUT_US
+#define HEALTH_BINS 5
+
+// Sector erase times are kept in 0.25ms steps, saturating at 63.75ms
+#define HEALTH_ERASE_UNIT_US 250
+
+void health_reset(void);
+void health_recordProgram(uint32_t address, uint32_t ticks);
+void health_recordProgramTimeout(uint32_t address);
+void health_recordErase(uint8_t sector, uint32_t ticks);
+void health_report(void);
+
+#endif // HEALTH_H_INCLUDED
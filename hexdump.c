@@ -0,0 +1,60 @@
+#include "hexdump.h"
+#include "atmega.h"
+
+static const char hex_digits[16] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
+
+char* hex_format(char* out, uint32_t value, uint8_t digits)
+{
+    char* const end = out + digits;
+
+    // fill from the right, one nibble per digit
+    for (char* cur = end; cur != out; )
+    {
+        *--cur = hex_digits[value & 0x0f];
+        value >>= 4;
+    }
+
+    return end;
+}
+
+uint8_t hex_nibble(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    c |= 0x20; // lower case
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    return 0xff;
+}
+
+void hex_line(uint32_t address, const uint8_t* data, uint8_t length)
+{
+    // address, ": ", 3 chars per byte, " ;ss", newline
+    char line[5 + 2 + 3 * HEXDUMP_WIDTH + 4 + 1];
+    char* cur = hex_format(line, address, 5);
+    uint8_t sum = 0;
+
+    *cur++ = ':';
+    for (uint8_t i = 0; i < length; i++)
+    {
+        *cur++ = ' ';
+        *cur++ = hex_digits[data[i] >> 4];
+        *cur++ = hex_digits[data[i] & 0x0f];
+        sum += data[i];
+    }
+
+#if HEXDUMP_CHECKSUM
+    *cur++ = ' ';
+    *cur++ = ';';
+    cur = hex_format(cur, sum, 2);
+#else
+    (void)sum;
+#endif
+    *cur++ = '\n';
+
+    UART_write((const uint8_t*)line, cur - line);
+}
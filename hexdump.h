@@ -0,0 +1,27 @@
+#ifndef HEXDUMP_H_INCLUDED
+#define HEXDUMP_H_INCLUDED
+
+#include <stdint.h>
+
+/* Text output for dumps without printf, lines go to the UART in one piece:
+    aaaaa: dd dd ... dd ;ss\n
+   5 hex digits of address, HEXDUMP_WIDTH data bytes (fewer on the last line) and, with HEXDUMP_CHECKSUM,
+   ss = 8 bit sum of the data bytes. */
+#ifndef HEXDUMP_WIDTH
+#define HEXDUMP_WIDTH 16 // 16 or 32
+#endif
+
+#ifndef HEXDUMP_CHECKSUM
+#define HEXDUMP_CHECKSUM 1
+#endif
+
+// write the low digits hex digits of value to out, most significant first. Returns the end of the digits
+char* hex_format(char* out, uint32_t value, uint8_t digits);
+
+// value of a hex digit, 0xff if c isn't one
+uint8_t hex_nibble(char c);
+
+// send one line of a dump, length is at most HEXDUMP_WIDTH
+void hex_line(uint32_t address, const uint8_t* data, uint8_t length);
+
+#endif // HEXDUMP_H_INCLUDED
@@ -0,0 +1,350 @@
+#include "cache.hpp"
+#include "crc.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <system_error>
+
+#include <unistd.h>
+
+static constexpr uint32_t SECTORS = CHIP_SIZE / SECTOR_SIZE;
+
+// spread over the chip, off the sector starts where images tend to agree
+static uint32_t sampleAddress(size_t index)
+{
+    const uint32_t stride = CHIP_SIZE / Fingerprint::SAMPLES;
+    return index * stride + (index * 0x9e5) % stride;
+}
+
+std::string Fingerprint::key() const
+{
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "%04x-%04x", crc, crc16(samples.data(), samples.size()));
+    return buf;
+}
+
+Fingerprint readFingerprint(Device& device)
+{
+    std::vector<std::pair<uint32_t, uint16_t>> ranges;
+    for (size_t i = 0; i < Fingerprint::SAMPLES; i++)
+    {
+        ranges.emplace_back(sampleAddress(i), 1);
+    }
+
+    // the device merges ranges, so look the samples up by address
+    std::map<uint32_t, uint8_t> bytes;
+    for (size_t first = 0; first < ranges.size(); first += GATHER_MAX_ENTRIES)
+    {
+        const size_t last = std::min<size_t>(ranges.size(), first + GATHER_MAX_ENTRIES);
+        device.send(Device::gatherRequest({ranges.begin() + first, ranges.begin() + last}));
+        for (const auto& run : Device::decodeGather(device.receive()))
+        {
+            for (size_t i = 0; i < run.data.size(); i++)
+            {
+                bytes[run.address + i] = run.data[i];
+            }
+        }
+    }
+
+    Fingerprint fingerprint;
+    for (size_t i = 0; i < Fingerprint::SAMPLES; i++)
+    {
+        const auto it = bytes.find(sampleAddress(i));
+        if (it == bytes.end())
+        {
+            throw std::runtime_error("sample missing from the gather reply");
+        }
+        fingerprint.samples[i] = it->second;
+    }
+    fingerprint.crc = readCrc(device, 0, CHIP_SIZE);
+    return fingerprint;
+}
+
+Fingerprint fingerprintOf(const std::vector<uint8_t>& contents)
+{
+    Fingerprint fingerprint;
+    for (size_t i = 0; i < Fingerprint::SAMPLES; i++)
+    {
+        fingerprint.samples[i] = contents[sampleAddress(i)];
+    }
+    fingerprint.crc = crc16(contents.data(), contents.size());
+    return fingerprint;
+}
+
+static std::vector<uint16_t> sectorCrcsOf(const std::vector<uint8_t>& contents)
+{
+    std::vector<uint16_t> crcs;
+    for (uint32_t base = 0; base < CHIP_SIZE; base += SECTOR_SIZE)
+    {
+        crcs.push_back(crc16(&contents[base], SECTOR_SIZE));
+    }
+    return crcs;
+}
+
+ContentCache::ContentCache(const std::string& dir, size_t max_entries) : dir_(dir), max_entries_(max_entries)
+{
+    std::filesystem::create_directories(dir_);
+}
+
+std::string ContentCache::path(const Fingerprint& fingerprint) const
+{
+    return dir_ + "/" + fingerprint.key() + ".bin";
+}
+
+bool ContentCache::lookup(const Fingerprint& fingerprint, CacheEntry& entry) const
+{
+    const std::string file = path(fingerprint);
+    std::ifstream in(file, std::ios::binary);
+    if (!in)
+    {
+        return false;
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (data.size() != CHIP_SIZE + SECTORS * 2)
+    {
+        return false;
+    }
+
+    entry.contents.assign(data.begin(), data.begin() + CHIP_SIZE);
+    entry.sector_crcs.clear();
+    for (uint32_t i = CHIP_SIZE; i < data.size(); i += 2)
+    {
+        entry.sector_crcs.push_back(static_cast<uint16_t>(data[i] << 8 | data[i + 1]));
+    }
+
+    // the key is only 32 bits, the entry has to match in full, and a damaged file is no entry
+    if (!(fingerprintOf(entry.contents) == fingerprint) || entry.sector_crcs != sectorCrcsOf(entry.contents))
+    {
+        return false;
+    }
+
+    // recently used entries survive pruning
+    std::error_code ignored;
+    std::filesystem::last_write_time(file, std::filesystem::file_time_type::clock::now(), ignored);
+    return true;
+}
+
+void ContentCache::store(const std::vector<uint8_t>& contents) const
+{
+    // unique per process and thread, workers may store the same contents at once
+    static std::atomic<unsigned> counter{0};
+
+    const std::string target = path(fingerprintOf(contents));
+    const std::string tmp = target + "." + std::to_string(getpid()) + "." + std::to_string(counter++) + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(contents.data()), contents.size());
+        for (const uint16_t crc : sectorCrcsOf(contents))
+        {
+            out.put(static_cast<char>(crc >> 8));
+            out.put(static_cast<char>(crc));
+        }
+        if (!out)
+        {
+            out.close();
+            std::remove(tmp.c_str());
+            throw std::runtime_error("can't write " + tmp);
+        }
+    }
+    if (std::rename(tmp.c_str(), target.c_str()) != 0)
+    {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("can't rename " + tmp);
+    }
+    prune();
+}
+
+void ContentCache::remove(const Fingerprint& fingerprint) const
+{
+    std::remove(path(fingerprint).c_str());
+}
+
+void ContentCache::prune() const
+{
+    namespace fs = std::filesystem;
+
+    std::vector<std::pair<fs::file_time_type, fs::path>> entries;
+    std::error_code error;
+    for (const auto& file : fs::directory_iterator(dir_, error))
+    {
+        if (file.path().extension() == ".bin")
+        {
+            entries.emplace_back(file.last_write_time(error), file.path());
+        }
+    }
+    if (entries.size() <= max_entries_)
+    {
+        return;
+    }
+
+    // newest first, everything past max_entries_ goes. Another worker may be pruning too
+    std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    for (size_t i = max_entries_; i < entries.size(); i++)
+    {
+        fs::remove(entries[i].second, error);
+    }
+}
+
+CachedPlan planCached(Device& device, const ContentCache& cache, const std::vector<uint8_t>& image, uint32_t start,
+                      CacheFill fill)
+{
+    CachedPlan plan;
+    plan.fill = fill;
+    CacheEntry entry;
+    const Fingerprint fingerprint = readFingerprint(device);
+    plan.result.hit = cache.lookup(fingerprint, entry);
+    const std::vector<uint8_t>& known = entry.contents;
+
+    // sectors the image changes, on a hit they're checked against the entry before anything is kept from it
+    std::vector<uint8_t> dirty;
+    if (plan.result.hit)
+    {
+        plan.target = known;
+        std::copy(image.begin(), image.end(), plan.target.begin() + start);
+
+        for (uint32_t sector = 0; sector < SECTORS; sector++)
+        {
+            const uint32_t base = sector * SECTOR_SIZE;
+            if (!std::equal(known.begin() + base, known.begin() + base + SECTOR_SIZE, plan.target.begin() + base))
+            {
+                dirty.push_back(sector);
+            }
+        }
+
+        const std::vector<uint16_t> crcs = readSectorCrcs(device, dirty);
+        for (size_t i = 0; i < dirty.size(); i++)
+        {
+            if (crcs[i] != entry.sector_crcs[dirty[i]])
+            {
+                cache.remove(fingerprint);
+                plan.result.hit = false;
+                break;
+            }
+        }
+    }
+
+    if (plan.result.hit)
+    {
+        // bytes to program over the whole chip, 0xff is left alone
+        plan.patch.assign(CHIP_SIZE, 0xff);
+        plan.patch_start = 0;
+
+        for (const uint8_t sector : dirty)
+        {
+            const uint32_t base = sector * SECTOR_SIZE;
+            bool erase = false;
+            for (uint32_t a = base; a < base + SECTOR_SIZE; a++)
+            {
+                erase = erase || (plan.target[a] & ~known[a]); // a bit has to go back to 1
+            }
+
+            plan.result.sectors_programmed++;
+            if (erase)
+            {
+                plan.erase.push_back(sector);
+                std::copy(plan.target.begin() + base, plan.target.begin() + base + SECTOR_SIZE, plan.patch.begin() + base);
+            }
+            else
+            {
+                for (uint32_t a = base; a < base + SECTOR_SIZE; a++)
+                {
+                    if (plan.target[a] != known[a])
+                    {
+                        plan.patch[a] = plan.target[a];
+                    }
+                }
+            }
+        }
+        plan.result.sectors_erased = plan.erase.size();
+    }
+    else
+    {
+        // the sectors the image touches are erased and get their bytes around the image back with it
+        plan.keep_first = start / SECTOR_SIZE * SECTOR_SIZE;
+        plan.keep_last = (start + image.size() + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+
+        plan.target.assign(CHIP_SIZE, 0xff);
+        auto keep = [&](uint32_t address, const std::vector<uint8_t>& data)
+        {
+            std::copy(data.begin(), data.end(), plan.target.begin() + address);
+        };
+        readRange(device, plan.keep_first, start, keep, nullptr);
+        readRange(device, start + image.size(), plan.keep_last, keep, nullptr);
+        std::copy(image.begin(), image.end(), plan.target.begin() + start);
+
+        plan.patch.assign(plan.target.begin() + plan.keep_first, plan.target.begin() + plan.keep_last);
+        plan.patch_start = plan.keep_first;
+        for (uint32_t sector = plan.keep_first / SECTOR_SIZE; sector < plan.keep_last / SECTOR_SIZE; sector++)
+        {
+            plan.erase.push_back(sector);
+        }
+        plan.result.sectors_erased = plan.result.sectors_programmed = plan.erase.size();
+    }
+
+    plan.result.bytes_sent = std::count_if(plan.patch.begin(), plan.patch.end(), [](uint8_t b) { return b != 0xff; });
+    return plan;
+}
+
+void eraseCached(Device& device, const CachedPlan& plan)
+{
+    if (plan.erase.size() == SECTORS)
+    {
+        eraseChip(device);
+    }
+    else if (!plan.erase.empty())
+    {
+        eraseSectors(device, plan.erase);
+    }
+}
+
+void transferCached(Device& device, CachedPlan& plan)
+{
+    programImage(device, plan.patch, plan.patch_start, plan.patch_start, EraseMode::None, nullptr);
+
+    // the rest of the chip fills the entry
+    if (!plan.result.hit && plan.fill == CacheFill::ReadBack)
+    {
+        auto keep = [&](uint32_t address, const std::vector<uint8_t>& data)
+        {
+            std::copy(data.begin(), data.end(), plan.target.begin() + address);
+        };
+        readRange(device, 0, plan.keep_first, keep, nullptr);
+        readRange(device, plan.keep_last, CHIP_SIZE, keep, nullptr);
+    }
+}
+
+void checkCached(Device& device, const ContentCache& cache, const CachedPlan& plan)
+{
+    // without the read back a miss only knows the sectors it touched
+    const bool partial = !plan.result.hit && plan.fill == CacheFill::None;
+    const uint32_t first = partial ? plan.keep_first : 0;
+    const uint32_t length = partial ? plan.keep_last - plan.keep_first : CHIP_SIZE;
+
+    const uint16_t crc = readCrc(device, first, length);
+    const uint16_t expected = crc16(plan.target.data() + first, length);
+    if (crc != expected)
+    {
+        char text[64];
+        std::snprintf(text, sizeof(text), "chip crc 0x%04x after programming, expected 0x%04x", crc, expected);
+        throw std::runtime_error(text);
+    }
+    if (!partial)
+    {
+        cache.store(plan.target);
+    }
+}
+
+CachedProgramResult programCached(Device& device, const ContentCache& cache, const std::vector<uint8_t>& image,
+                                  uint32_t start, CacheFill fill)
+{
+    CachedPlan plan = planCached(device, cache, image, start, fill);
+    eraseCached(device, plan);
+    transferCached(device, plan);
+    checkCached(device, cache, plan);
+    return plan.result;
+}
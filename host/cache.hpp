@@ -0,0 +1,108 @@
+#ifndef CACHE_HPP_INCLUDED
+#define CACHE_HPP_INCLUDED
+
+#include "device.hpp"
+#include "operations.hpp"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* What a chip holds, cheap to read from the device: a few bytes sampled across the chip
+   and the crc of the whole chip. The device ID would belong here too, but reading it is
+   still disabled in the firmware. */
+struct Fingerprint
+{
+    static constexpr size_t SAMPLES = 32;
+
+    uint16_t crc = 0;
+    std::array<uint8_t, SAMPLES> samples{};
+
+    std::string key() const;
+    bool operator==(const Fingerprint& other) const { return crc == other.crc && samples == other.samples; }
+};
+
+Fingerprint readFingerprint(Device& device);
+Fingerprint fingerprintOf(const std::vector<uint8_t>& contents);
+
+// Contents of a chip and the crc of each of its sectors
+struct CacheEntry
+{
+    std::vector<uint8_t> contents;
+    std::vector<uint16_t> sector_crcs;
+};
+
+/* Last known contents of chips, one file per fingerprint in a directory, so a chip that
+   comes back with contents seen before needs only its fingerprint read to be known.
+   An entry is the contents followed by the sector crcs. The least recently used entries
+   beyond max_entries are removed when a new one is stored. */
+class ContentCache
+{
+public:
+    static constexpr size_t DEFAULT_MAX_ENTRIES = 32;
+
+    explicit ContentCache(const std::string& dir, size_t max_entries = DEFAULT_MAX_ENTRIES);
+
+    // entry for a fingerprint, false if there is none or it doesn't match
+    bool lookup(const Fingerprint& fingerprint, CacheEntry& entry) const;
+    void store(const std::vector<uint8_t>& contents) const;
+    // drop an entry the chip turned out not to match
+    void remove(const Fingerprint& fingerprint) const;
+
+private:
+    std::string path(const Fingerprint& fingerprint) const;
+    void prune() const;
+
+    std::string dir_;
+    size_t max_entries_;
+};
+
+enum class CacheFill
+{
+    ReadBack, // a miss reads the untouched sectors back and stores the whole chip
+    None // a miss only checks the sectors it touched and stores nothing
+};
+
+struct CachedProgramResult
+{
+    bool hit = false; // the chip's contents were known
+    unsigned sectors_erased = 0;
+    unsigned sectors_programmed = 0;
+    uint32_t bytes_sent = 0;
+};
+
+/* A cached program in phases, so a rack can overlap erases and crc checks on some boards
+   with transfers on others: planning reads the fingerprint and, on a hit, the crcs of the
+   sectors that change or, on a miss, the bytes around the image in the sectors it touches,
+   erasing and checking move next to nothing over the link, transferring programs the patch
+   and, with CacheFill::ReadBack, reads back the rest of the chip on a miss. */
+struct CachedPlan
+{
+    CachedProgramResult result;
+    std::vector<uint8_t> target; // contents of the whole chip once programmed
+    std::vector<uint8_t> patch; // programmed at patch_start, 0xff bytes are skipped
+    uint32_t patch_start = 0;
+    std::vector<uint8_t> erase; // sectors erased before the transfer
+    uint32_t keep_first = 0; // the sectors a miss erases, the chip outside them is read back
+    uint32_t keep_last = 0;
+    CacheFill fill = CacheFill::ReadBack;
+};
+
+CachedPlan planCached(Device& device, const ContentCache& cache, const std::vector<uint8_t>& image, uint32_t start,
+                      CacheFill fill = CacheFill::ReadBack);
+void eraseCached(Device& device, const CachedPlan& plan);
+void transferCached(Device& device, CachedPlan& plan);
+void checkCached(Device& device, const ContentCache& cache, const CachedPlan& plan);
+
+/* Program image at start using the cache. On a hit the sectors whose contents change are
+   checked against the entry's sector crcs first, a mismatch drops the entry and makes it a miss.
+   Only those sectors are touched: bits that only need clearing are programmed in place, anything
+   else is erased and rewritten, keeping the bytes around the image. On a miss the sectors the image touches
+   are read, erased and programmed with the image and their bytes around it, so a miss leaves the chip as a
+   hit would. With CacheFill::ReadBack the untouched sectors are then read back to fill the entry and the
+   whole chip crc is checked before storing it, with CacheFill::None only the touched sectors are checked. */
+CachedProgramResult programCached(Device& device, const ContentCache& cache, const std::vector<uint8_t>& image,
+                                  uint32_t start, CacheFill fill = CacheFill::ReadBack);
+
+#endif // CACHE_HPP_INCLUDED
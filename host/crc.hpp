@@ -0,0 +1,30 @@
+#ifndef CRC_HPP_INCLUDED
+#define CRC_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+extern "C" {
+#include "protocol.h"
+}
+
+// CRC-16/MCRF4XX, the same checksum as avr-libc _crc_ccitt_update used by the firmware
+inline uint16_t crcUpdate(uint16_t crc, const uint8_t* buf, size_t length)
+{
+    while (length--)
+    {
+        crc ^= *buf++;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : (crc >> 1);
+        }
+    }
+    return crc;
+}
+
+inline uint16_t crc16(const uint8_t* buf, size_t length)
+{
+    return crcUpdate(FRAME_CRC_INIT, buf, length);
+}
+
+#endif // CRC_HPP_INCLUDED
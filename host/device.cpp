@@ -0,0 +1,437 @@
+#include "device.hpp"
+#include "crc.hpp"
+
+#include <stdexcept>
+
+// binary command characters, see main.c
+static constexpr uint8_t CMD_GATHER = 'g';
+static constexpr uint8_t CMD_BATCH = 'b';
+static constexpr uint8_t CMD_DUMP_CHUNK = 'k';
+
+// chunk number, data, device time
+static constexpr size_t DUMP_CHUNK_PAYLOAD = 2 + DUMP_CHUNK_SIZE + 4;
+
+// Frame length (type, payload and crc) if enough has arrived to know it, otherwise
+// the size the frame has to reach before asking again. Zero for unknown frame types.
+static size_t frameLength(const std::vector<uint8_t>& f, bool& complete)
+{
+    complete = false;
+
+    if (f[0] == CMD_GATHER)
+    {
+        if (f.size() < 2)
+        {
+            return 2;
+        }
+        size_t pos = 2;
+        for (unsigned run = 0; run < f[1]; run++)
+        {
+            if (f.size() < pos + GATHER_RUN_HEADER_SIZE)
+            {
+                return pos + GATHER_RUN_HEADER_SIZE;
+            }
+            const size_t length = (f[pos + 3] << 16) | (f[pos + 4] << 8) | f[pos + 5];
+            pos += GATHER_RUN_HEADER_SIZE + length;
+        }
+        complete = true;
+        return pos + 2;
+    }
+    else if (f[0] == CMD_BATCH)
+    {
+        size_t pos = 1;
+        while (true)
+        {
+            if (f.size() < pos + BATCH_RESULT_SIZE)
+            {
+                return pos + BATCH_RESULT_SIZE;
+            }
+            const uint8_t op = f[pos];
+            pos += BATCH_RESULT_SIZE;
+            if (op == BATCH_END)
+            {
+                complete = true;
+                return pos + 2;
+            }
+        }
+    }
+    else if (f[0] == CMD_DUMP_CHUNK)
+    {
+        complete = true;
+        return 1 + DUMP_CHUNK_PAYLOAD + 2;
+    }
+
+    return 0;
+}
+
+Device::Device(const std::string& path, unsigned baud, size_t window)
+    : port_(path, baud), baud_(baud), window_(window)
+{
+    // replies to a killed client's requests may still be coming, drop them until the line
+    // has been idle for the time of the longest frame
+    const int idle_ms = static_cast<int>((1 + DUMP_CHUNK_PAYLOAD + 3) * 10ull * 1000 / baud) + 1;
+    uint8_t stale[256];
+    while (port_.read(stale, sizeof(stale), idle_ms) > 0)
+    {
+    }
+
+    reader_ = std::thread(&Device::readerLoop, this);
+}
+
+Device::~Device()
+{
+    stop_ = true;
+    reader_.join();
+}
+
+void Device::send(const std::vector<uint8_t>& request)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&] {
+            return !error_.empty() || inflight_.empty() || inflight_bytes_ + request.size() <= window_;
+        });
+        if (!error_.empty())
+        {
+            throw std::runtime_error(error_);
+        }
+        inflight_.push_back(request.size());
+        inflight_bytes_ += request.size();
+    }
+
+    port_.write(request.data(), request.size());
+}
+
+Reply Device::receive(std::chrono::milliseconds timeout)
+{
+    Reply reply;
+    if (!tryReceive(reply, timeout))
+    {
+        throw std::runtime_error(port_.path() + ": timeout waiting for the device");
+    }
+    return reply;
+}
+
+bool Device::tryReceive(Reply& reply, std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!cv_.wait_for(lock, timeout, [&] { return !replies_.empty() || !error_.empty(); }))
+    {
+        return false;
+    }
+    if (replies_.empty())
+    {
+        throw std::runtime_error(error_);
+    }
+
+    reply = std::move(replies_.front());
+    replies_.pop_front();
+
+    if (!inflight_.empty())
+    {
+        inflight_bytes_ -= inflight_.front();
+        inflight_.pop_front();
+    }
+    cv_.notify_all();
+
+    return true;
+}
+
+void Device::abandon()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!inflight_.empty())
+    {
+        inflight_bytes_ -= inflight_.front();
+        inflight_.pop_front();
+    }
+    cv_.notify_all();
+}
+
+size_t Device::pending() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return inflight_.size();
+}
+
+bool Device::canSend(size_t length) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return inflight_.empty() || inflight_bytes_ + length <= window_;
+}
+
+void Device::readerLoop()
+{
+    uint8_t buf[512];
+
+    try
+    {
+        while (!stop_)
+        {
+            const size_t n = port_.read(buf, sizeof(buf), 100);
+            for (size_t i = 0; i < n; i++)
+            {
+                parse(buf[i]);
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_ = e.what();
+        cv_.notify_all();
+    }
+}
+
+// split the stream into frames, echoed and debug text in between is dropped
+void Device::parse(uint8_t byte)
+{
+    if (!in_frame_)
+    {
+        if (byte == FRAME_START)
+        {
+            in_frame_ = true;
+            frame_.clear();
+            line_.clear();
+        }
+        else if (byte == '\n' || byte == '\r')
+        {
+            if (line_ == "ERROR")
+            {
+                deliver(Reply{});
+            }
+            line_.clear();
+        }
+        else if (line_.size() < 256)
+        {
+            line_.push_back(static_cast<char>(byte));
+        }
+        return;
+    }
+
+    frame_.push_back(byte);
+
+    if (frame_.size() == 1)
+    {
+        check_at_ = 1;
+    }
+    if (frame_.size() < check_at_)
+    {
+        return;
+    }
+
+    bool complete = false;
+    const size_t length = frameLength(frame_, complete);
+    if (!length)
+    {
+        // not a frame after all, go back to looking for one
+        in_frame_ = false;
+        return;
+    }
+    if (!complete || frame_.size() < length)
+    {
+        check_at_ = length;
+        return;
+    }
+
+    in_frame_ = false;
+
+    const uint16_t crc = (frame_[length - 2] << 8) | frame_[length - 1];
+    frame_.resize(length - 2);
+
+    Reply reply;
+    reply.ok = crc16(frame_.data(), frame_.size()) == crc;
+    reply.frame = std::move(frame_);
+    frame_.clear();
+    deliver(std::move(reply));
+}
+
+void Device::deliver(Reply reply)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    replies_.push_back(std::move(reply));
+    cv_.notify_all();
+}
+
+// binary command header, the firmware skips echo and text parsing for it
+static void append24(std::vector<uint8_t>& out, uint32_t value)
+{
+    out.push_back(static_cast<uint8_t>(value >> 16));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+static void appendCommand(std::vector<uint8_t>& request, char cmd, uint32_t argument)
+{
+    request.reserve(request.size() + COMMAND_HEADER_SIZE);
+    request.push_back(COMMAND_START);
+    request.push_back(static_cast<uint8_t>(cmd));
+    append24(request, argument);
+    append24(request, 0);
+}
+
+std::vector<uint8_t> Device::gatherRequest(uint32_t address, uint16_t length)
+{
+    return gatherRequest({{address, length}});
+}
+
+std::vector<uint8_t> Device::gatherRequest(const std::vector<std::pair<uint32_t, uint16_t>>& ranges)
+{
+    if (ranges.size() > GATHER_MAX_ENTRIES)
+    {
+        throw std::length_error("more than GATHER_MAX_ENTRIES ranges");
+    }
+
+    std::vector<uint8_t> request;
+    appendCommand(request, CMD_GATHER, ranges.size());
+    for (const auto& range : ranges)
+    {
+        append24(request, range.first);
+        request.push_back(static_cast<uint8_t>(range.second >> 8));
+        request.push_back(static_cast<uint8_t>(range.second));
+    }
+    return request;
+}
+
+std::vector<uint8_t> Device::batchRequest(const std::vector<uint8_t>& records)
+{
+    if (records.size() > BATCH_MAX_SIZE)
+    {
+        throw std::length_error("batch larger than BATCH_MAX_SIZE");
+    }
+
+    std::vector<uint8_t> request;
+    appendCommand(request, CMD_BATCH, records.size());
+    request.insert(request.end(), records.begin(), records.end());
+    return request;
+}
+
+std::vector<uint8_t> Device::chunkRequest(uint16_t chunk)
+{
+    std::vector<uint8_t> request;
+    appendCommand(request, CMD_DUMP_CHUNK, chunk);
+    return request;
+}
+
+std::vector<GatherRun> Device::decodeGather(const Reply& reply)
+{
+    if (!reply.ok || reply.frame.size() < 2 || reply.frame[0] != CMD_GATHER)
+    {
+        throw std::runtime_error("bad gather reply");
+    }
+
+    std::vector<GatherRun> runs;
+    const auto& f = reply.frame;
+    size_t pos = 2;
+    for (unsigned run = 0; run < f[1]; run++)
+    {
+        const uint32_t address = (f[pos] << 16) | (f[pos + 1] << 8) | f[pos + 2];
+        const size_t length = (f[pos + 3] << 16) | (f[pos + 4] << 8) | f[pos + 5];
+        pos += GATHER_RUN_HEADER_SIZE;
+        runs.push_back({address, std::vector<uint8_t>(f.begin() + pos, f.begin() + pos + length)});
+        pos += length;
+    }
+    return runs;
+}
+
+DumpChunk Device::decodeChunk(const Reply& reply)
+{
+    const auto& f = reply.frame;
+    if (!reply.ok || f.size() != 1 + DUMP_CHUNK_PAYLOAD || f[0] != CMD_DUMP_CHUNK)
+    {
+        throw std::runtime_error("bad dump chunk reply");
+    }
+
+    DumpChunk chunk;
+    chunk.number = (f[1] << 8) | f[2];
+    chunk.data.assign(f.begin() + 3, f.begin() + 3 + DUMP_CHUNK_SIZE);
+    const size_t pos = 3 + DUMP_CHUNK_SIZE;
+    chunk.device_us = (uint32_t(f[pos]) << 24) | (f[pos + 1] << 16) | (f[pos + 2] << 8) | f[pos + 3];
+    return chunk;
+}
+
+std::vector<BatchResult> Device::decodeBatch(const Reply& reply)
+{
+    if (!reply.ok || reply.frame.empty() || reply.frame[0] != CMD_BATCH)
+    {
+        throw std::runtime_error("bad batch reply");
+    }
+
+    std::vector<BatchResult> results;
+    const auto& f = reply.frame;
+    for (size_t pos = 1; pos + BATCH_RESULT_SIZE <= f.size(); pos += BATCH_RESULT_SIZE)
+    {
+        const BatchResult result{f[pos], f[pos + 1], static_cast<uint16_t>((f[pos + 2] << 8) | f[pos + 3])};
+        if (result.op == BATCH_END)
+        {
+            break;
+        }
+        results.push_back(result);
+    }
+    return results;
+}
+
+std::vector<uint8_t> Device::read(uint32_t address, uint16_t length)
+{
+    send(gatherRequest(address, length));
+    const auto runs = decodeGather(receive());
+    if (runs.size() != 1 || runs[0].address != address)
+    {
+        throw std::runtime_error("unexpected gather reply");
+    }
+    return runs[0].data;
+}
+
+std::vector<BatchResult> Device::batch(const std::vector<uint8_t>& records, std::chrono::milliseconds timeout)
+{
+    send(batchRequest(records));
+    return decodeBatch(receive(timeout));
+}
+
+void appendChipErase(std::vector<uint8_t>& records)
+{
+    records.push_back('f');
+}
+
+void appendSectorErase(std::vector<uint8_t>& records, uint8_t sector)
+{
+    records.push_back('s');
+    records.push_back(sector);
+}
+
+void appendWrite(std::vector<uint8_t>& records, uint32_t address, const uint8_t* data, uint16_t length)
+{
+    records.push_back('w');
+    append24(records, address);
+    records.push_back(static_cast<uint8_t>(length >> 8));
+    records.push_back(static_cast<uint8_t>(length));
+    records.insert(records.end(), data, data + length);
+}
+
+void appendCrc(std::vector<uint8_t>& records, uint32_t address, uint32_t length)
+{
+    records.push_back('c');
+    append24(records, address);
+    append24(records, length);
+}
+
+void appendSelect(std::vector<uint8_t>& records, uint8_t chips)
+{
+    records.push_back('e');
+    records.push_back(chips);
+}
+
+void appendCopy(std::vector<uint8_t>& records, uint8_t source, uint8_t destination)
+{
+    records.push_back('y');
+    records.push_back(source);
+    records.push_back(destination);
+}
+
+void appendFill(std::vector<uint8_t>& records, uint32_t address, uint32_t length, uint8_t pattern, uint8_t seed)
+{
+    records.push_back('t');
+    append24(records, address);
+    append24(records, length);
+    records.push_back(pattern);
+    records.push_back(seed);
+}
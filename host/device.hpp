@@ -0,0 +1,128 @@
+#ifndef DEVICE_HPP_INCLUDED
+#define DEVICE_HPP_INCLUDED
+
+#include "serial.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// One reply to a binary command: the checked frame (type and payload) or the device's ERROR line
+struct Reply
+{
+    bool ok = false;
+    std::vector<uint8_t> frame;
+};
+
+// Run/data pair from a gather reply
+struct GatherRun
+{
+    uint32_t address;
+    std::vector<uint8_t> data;
+};
+
+// Chunk of a chunked dump
+struct DumpChunk
+{
+    uint16_t number;
+    std::vector<uint8_t> data;
+    uint32_t device_us; // time the device spent on it
+};
+
+// Result record from a batch reply
+struct BatchResult
+{
+    uint8_t op;
+    uint8_t status;
+    uint16_t value;
+};
+
+/* Pipelined connection to the programmer.
+   Requests are written as soon as the send window allows, a reader thread parses
+   replies off the wire and hands them back in order. The window is the number of
+   request bytes the device may hold unprocessed, its receive buffer is 256 bytes. */
+class Device
+{
+public:
+    static constexpr size_t DEFAULT_WINDOW = 240;
+
+    Device(const std::string& path, unsigned baud, size_t window = DEFAULT_WINDOW);
+    ~Device();
+
+    // blocks while the send window is full
+    void send(const std::vector<uint8_t>& request);
+
+    // next reply in request order, throws on timeout
+    Reply receive(std::chrono::milliseconds timeout = std::chrono::seconds(10));
+    // same, but false on timeout so the caller can ask again
+    bool tryReceive(Reply& reply, std::chrono::milliseconds timeout);
+    // the oldest request's reply was lost on the wire, stop counting it against the window
+    void abandon();
+
+    // requests still waiting for a reply
+    size_t pending() const;
+    // true if a request of this size fits in the window right now
+    bool canSend(size_t length) const;
+    size_t window() const { return window_; }
+    unsigned baud() const { return baud_; }
+
+    const std::string& path() const { return port_.path(); }
+
+    // request builders
+    static std::vector<uint8_t> gatherRequest(uint32_t address, uint16_t length);
+    static std::vector<uint8_t> gatherRequest(const std::vector<std::pair<uint32_t, uint16_t>>& ranges);
+    static std::vector<uint8_t> batchRequest(const std::vector<uint8_t>& records);
+    static std::vector<uint8_t> chunkRequest(uint16_t chunk);
+
+    // reply decoders, throw if the reply doesn't match
+    static std::vector<GatherRun> decodeGather(const Reply& reply);
+    static std::vector<BatchResult> decodeBatch(const Reply& reply);
+    static DumpChunk decodeChunk(const Reply& reply);
+
+    // simple round trips
+    std::vector<uint8_t> read(uint32_t address, uint16_t length);
+    std::vector<BatchResult> batch(const std::vector<uint8_t>& records, std::chrono::milliseconds timeout);
+
+private:
+    void readerLoop();
+    void parse(uint8_t byte);
+    void deliver(Reply reply);
+
+    SerialPort port_;
+    const unsigned baud_;
+    const size_t window_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<size_t> inflight_; // size of each request still waiting for its reply
+    size_t inflight_bytes_ = 0;
+    std::deque<Reply> replies_;
+    std::string error_;
+
+    std::atomic<bool> stop_{false};
+    std::thread reader_;
+
+    // reader state, only touched by the reader thread
+    bool in_frame_ = false;
+    std::string line_;
+    std::vector<uint8_t> frame_;
+    size_t check_at_ = 1;
+};
+
+// batch record builders, layout in protocol.h
+void appendChipErase(std::vector<uint8_t>& records);
+void appendSectorErase(std::vector<uint8_t>& records, uint8_t sector);
+void appendWrite(std::vector<uint8_t>& records, uint32_t address, const uint8_t* data, uint16_t length);
+void appendCrc(std::vector<uint8_t>& records, uint32_t address, uint32_t length);
+void appendSelect(std::vector<uint8_t>& records, uint8_t chips);
+void appendCopy(std::vector<uint8_t>& records, uint8_t source, uint8_t destination);
+void appendFill(std::vector<uint8_t>& records, uint32_t address, uint32_t length, uint8_t pattern, uint8_t seed);
+
+#endif // DEVICE_HPP_INCLUDED
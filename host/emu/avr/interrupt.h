@@ -0,0 +1,15 @@
+#ifndef EMU_AVR_INTERRUPT_H_INCLUDED
+#define EMU_AVR_INTERRUPT_H_INCLUDED
+
+#include "emu_io.hpp"
+
+#include <atomic>
+
+#define ISR(vector) void vector(void)
+#define sei() emu_sei()
+#define cli() emu_cli()
+
+// interrupts run on a thread of their own here, so what they share with the firmware has to be atomic
+#define ISR_SHARED_UINT8 std::atomic<uint8_t>
+
+#endif // EMU_AVR_INTERRUPT_H_INCLUDED
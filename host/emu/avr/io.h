@@ -0,0 +1,69 @@
+/* Stand-in for avr-libc's <avr/io.h> when the firmware is built for the emulator.
+   Registers become objects that drive the bus, UART and timer models. */
+#ifndef EMU_AVR_IO_H_INCLUDED
+#define EMU_AVR_IO_H_INCLUDED
+
+#include "emu_io.hpp"
+
+// everything from the C library the firmware uses, pulled in before the macros below rename things
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define PORTA (EmuReg8{EMU_PORTA})
+#define PORTB (EmuReg8{EMU_PORTB})
+#define PORTC (EmuReg8{EMU_PORTC})
+#define PORTD (EmuReg8{EMU_PORTD})
+#define PINA (EmuReg8{EMU_PINA})
+#define PINB (EmuReg8{EMU_PINB})
+#define PINC (EmuReg8{EMU_PINC})
+#define PIND (EmuReg8{EMU_PIND})
+#define DDRA (EmuReg8{EMU_DDRA})
+#define DDRB (EmuReg8{EMU_DDRB})
+#define DDRC (EmuReg8{EMU_DDRC})
+#define DDRD (EmuReg8{EMU_DDRD})
+#define UCSRA (EmuReg8{EMU_UCSRA})
+#define UCSRB (EmuReg8{EMU_UCSRB})
+#define UCSRC (EmuReg8{EMU_UCSRC})
+#define UBRRL (EmuReg8{EMU_UBRRL})
+#define UBRRH (EmuReg8{EMU_UBRRH})
+#define UDR (EmuReg8{EMU_UDR})
+#define TCCR1A (EmuReg8{EMU_TCCR1A})
+#define TCCR1B (EmuReg8{EMU_TCCR1B})
+#define TIMSK (EmuReg8{EMU_TIMSK})
+#define TIFR (EmuReg8{EMU_TIFR})
+#define SREG (EmuReg8{EMU_SREG})
+#define TCNT1 (EmuTimer16{})
+
+// UCSRA
+#define RXC 7
+#define UDRE 5
+#define DOR 3
+// UCSRB
+#define RXCIE 7
+#define RXEN 4
+#define TXEN 3
+// UCSRC
+#define URSEL 7
+#define UCSZ0 1
+// TCCR1B
+#define CS12 2
+#define CS11 1
+#define CS10 0
+// TIMSK, TIFR
+#define TOIE1 2
+#define TOV1 2
+
+// avr-libc stdio, printf goes through stdout
+#define FILE emu_file
+#define FDEV_SETUP_STREAM(p, g, f) {p}
+#define _FDEV_SETUP_WRITE 0
+#undef stdout
+#define stdout emu_stdout
+#define printf emu_printf
+
+#define __asm__(code) emu_asm(code)
+
+#endif // EMU_AVR_IO_H_INCLUDED
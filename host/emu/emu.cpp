@@ -0,0 +1,435 @@
+// Register level models behind the emulated ATmega32: address/data bus, UART, Timer1 and interrupts
+#include "emu.hpp"
+#include "emu_io.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+// control lines on PORTD, active low (see SST39SF020A.h). Chip n's CE is CHIP_ENABLE[n]
+static constexpr uint8_t CHIP_ENABLE[EMU_MAX_CHIPS] = {1 << 5, 1 << 2};
+static constexpr uint8_t OUTPUT_ENABLE = 1 << 4;
+static constexpr uint8_t WRITE_ENABLE = 1 << 3;
+
+// register bits
+static constexpr uint8_t RXC = 1 << 7;
+static constexpr uint8_t UDRE = 1 << 5;
+static constexpr uint8_t DOR = 1 << 3;
+static constexpr uint8_t RXCIE = 1 << 7;
+static constexpr uint8_t TOIE1 = 1 << 2;
+static constexpr uint8_t TOV1 = 1 << 2;
+static constexpr uint8_t SREG_I = 1 << 7;
+
+static constexpr size_t RX_FIFO_DEPTH = 2; // UDR is double buffered
+
+// registers are read by the interrupt thread too (interrupt enables, timer clock select)
+static std::atomic<uint8_t> regs[EMU_REGISTER_COUNT];
+static std::vector<std::unique_ptr<SST39SF>> chips;
+
+// The firmware thread holds irq_mutex while interrupts are disabled, ISRs run on the interrupt thread under it
+static std::mutex irq_mutex;
+static std::atomic<bool> irq_enabled{false};
+
+static std::mutex uart_mutex; // guards the line rate and the receive FIFO
+static int uart_fd = -1;
+static unsigned uart_baud = 0;
+static Clock::duration char_time{};
+static std::deque<uint8_t> rx_fifo;
+static bool rx_overrun = false;
+static Clock::time_point tx_shift_end;
+static std::atomic<uint64_t> rx_bytes{0}, tx_bytes{0}, rx_overruns{0}, bus_contention{0}, tx_faults{0};
+static uint64_t tx_written = 0; // bytes the firmware has put in UDR, faults count these
+static uint64_t tx_drop_at = 0, tx_drop_length = 0, tx_flip_at = 0;
+
+static std::atomic<bool> timer_running{false};
+static Clock::time_point timer_start;
+static std::atomic<uint64_t> overflows_delivered{0};
+
+static Clock::time_point cpu_time; // where the firmware's counted cycles have got to
+
+// weak defaults for vectors the firmware doesn't define
+__attribute__((weak)) void USART_RXC_vect(void) {}
+__attribute__((weak)) void TIMER1_OVF_vect(void) {}
+
+static void setBaud(unsigned baud)
+{
+    std::lock_guard<std::mutex> lock(uart_mutex);
+    uart_baud = baud;
+    char_time = std::chrono::nanoseconds(10ull * 1000000000ull / baud); // 8N1
+}
+
+static uint32_t address()
+{
+    return regs[EMU_PORTA] | (regs[EMU_PORTC] << 8) | (((regs[EMU_PORTD] >> 6) & 0x03) << 16);
+}
+
+static uint64_t timerTicks()
+{
+    static const unsigned prescaler[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+    const unsigned divide = prescaler[regs[EMU_TCCR1B] & 0x07];
+    if (!timer_running || !divide)
+    {
+        return 0;
+    }
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - timer_start).count();
+    return static_cast<uint64_t>(ns) * (F_CPU / divide) / 1000000000ull;
+}
+
+static bool overflowPending()
+{
+    return timerTicks() >> 16 > overflows_delivered;
+}
+
+uint16_t emu_readTimer(void)
+{
+    return static_cast<uint16_t>(timerTicks());
+}
+
+uint8_t emu_read(EmuRegister reg)
+{
+    switch (reg)
+    {
+        case EMU_PINB:
+        {
+            const uint8_t control = regs[EMU_PORTD];
+            uint8_t value = regs[EMU_DDRB] ? regs[EMU_PORTB].load() : 0xff; // pull ups, or our own outputs
+            unsigned driving = regs[EMU_DDRB] ? 1 : 0;
+
+            if (!(control & OUTPUT_ENABLE) && (control & WRITE_ENABLE))
+            {
+                for (size_t i = 0; i < chips.size(); i++)
+                {
+                    if (!(control & CHIP_ENABLE[i]))
+                    {
+                        // several outputs fighting, call it a wired AND
+                        value = driving++ ? value & chips[i]->read(address()) : chips[i]->read(address());
+                    }
+                }
+            }
+            if (driving > 1)
+            {
+                bus_contention++;
+            }
+            return value;
+        }
+        case EMU_PINA: return regs[EMU_PORTA];
+        case EMU_PINC: return regs[EMU_PORTC];
+        case EMU_PIND: return regs[EMU_PORTD];
+
+        case EMU_UCSRA:
+        {
+            std::lock_guard<std::mutex> lock(uart_mutex);
+            uint8_t status = 0;
+            if (!rx_fifo.empty())
+            {
+                status |= RXC;
+            }
+            if (Clock::now() + char_time >= tx_shift_end)
+            {
+                status |= UDRE;
+            }
+            if (rx_overrun)
+            {
+                status |= DOR;
+            }
+            return status;
+        }
+        case EMU_UDR:
+        {
+            std::lock_guard<std::mutex> lock(uart_mutex);
+            if (rx_fifo.empty())
+            {
+                return 0;
+            }
+            const uint8_t data = rx_fifo.front();
+            rx_fifo.pop_front();
+            rx_overrun = false;
+            return data;
+        }
+
+        case EMU_TIFR:
+            return overflowPending() ? TOV1 : 0;
+        case EMU_SREG:
+            return irq_enabled ? SREG_I : 0;
+
+        default:
+            return regs[reg];
+    }
+}
+
+void emu_write(EmuRegister reg, uint8_t value)
+{
+    switch (reg)
+    {
+        case EMU_PORTD:
+        {
+            const uint8_t old = regs[EMU_PORTD];
+            regs[EMU_PORTD] = value;
+
+            // data is latched on the first rising edge of WE# or CE# while the other is low
+            for (size_t i = 0; i < chips.size(); i++)
+            {
+                const uint8_t ce = CHIP_ENABLE[i];
+                const bool we_rise = !(old & WRITE_ENABLE) && (value & WRITE_ENABLE) && !(old & ce);
+                const bool ce_rise = !(old & ce) && (value & ce) && !(old & WRITE_ENABLE);
+                if ((we_rise || ce_rise) && (old & OUTPUT_ENABLE))
+                {
+                    chips[i]->write(address(), regs[EMU_DDRB] ? regs[EMU_PORTB].load() : 0xff);
+                }
+            }
+            return;
+        }
+
+        case EMU_UDR:
+        {
+            std::lock_guard<std::mutex> lock(uart_mutex);
+            tx_shift_end = std::max(tx_shift_end, Clock::now()) + char_time;
+            tx_written++;
+            if (tx_drop_at && tx_written >= tx_drop_at && tx_written - tx_drop_at < tx_drop_length)
+            {
+                tx_faults++;
+                return;
+            }
+            if (tx_written == tx_flip_at)
+            {
+                tx_faults++;
+                value ^= 0x01;
+            }
+            if (uart_fd >= 0 && ::write(uart_fd, &value, 1) == 1)
+            {
+                tx_bytes++;
+            }
+            return;
+        }
+
+        case EMU_UBRRL:
+        case EMU_UBRRH:
+        {
+            regs[reg] = value;
+            bool fixed;
+            {
+                std::lock_guard<std::mutex> lock(uart_mutex);
+                fixed = uart_baud != 0;
+            }
+            if (!fixed && reg == EMU_UBRRH)
+            {
+                // firmware sets UBRRL first, UBRRH completes the divider
+                setBaud(F_CPU / (16ul * (((regs[EMU_UBRRH] & 0x0f) << 8 | regs[EMU_UBRRL]) + 1)));
+            }
+            return;
+        }
+
+        case EMU_TCCR1B:
+            regs[reg] = value;
+            if ((value & 0x07) && !timer_running)
+            {
+                timer_start = Clock::now();
+                timer_running = true;
+            }
+            return;
+
+        case EMU_SREG:
+            if (value & SREG_I)
+            {
+                emu_sei();
+            }
+            else
+            {
+                emu_cli();
+            }
+            return;
+
+        default:
+            regs[reg] = value;
+            return;
+    }
+}
+
+void emu_cli(void)
+{
+    if (irq_enabled)
+    {
+        irq_mutex.lock();
+        irq_enabled = false;
+    }
+}
+
+void emu_sei(void)
+{
+    if (!irq_enabled)
+    {
+        irq_enabled = true;
+        irq_mutex.unlock();
+    }
+}
+
+/* The only inline assembly in the firmware is nops. A block of seven is the body of
+   delay_us(), which is tuned to 12 cycles (1us at 12MHz) per pass, anything else is one
+   cycle per nop. The firmware is held back whenever it runs ahead of the counted cycles. */
+void emu_asm(const char* code)
+{
+    unsigned nops = 0;
+    for (const char* p = std::strstr(code, "nop"); p; p = std::strstr(p + 3, "nop"))
+    {
+        nops++;
+    }
+    const unsigned cycles = nops >= 7 ? 12 : nops;
+
+    const auto now = Clock::now();
+    cpu_time = std::max(cpu_time, now) + std::chrono::nanoseconds(cycles * 1000000000ull / F_CPU);
+    if (cpu_time - now > std::chrono::microseconds(50))
+    {
+        std::this_thread::sleep_until(cpu_time);
+    }
+}
+
+// printf as the firmware sees it: AVR longs are 32bit, so %l is dropped before formatting
+emu_file* emu_stdout = nullptr;
+
+int emu_printf(const char* format, ...)
+{
+    std::string host_format;
+    for (const char* p = format; *p; p++)
+    {
+        host_format.push_back(*p);
+        if (*p == '%')
+        {
+            while (p[1] && std::strchr("-+ #0123456789.", p[1]))
+            {
+                host_format.push_back(*++p);
+            }
+            if (p[1] == 'l')
+            {
+                p++;
+            }
+        }
+    }
+
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    const int length = std::vsnprintf(buf, sizeof(buf), host_format.c_str(), args);
+    va_end(args);
+
+    for (int i = 0; i < length && i < static_cast<int>(sizeof(buf)) - 1; i++)
+    {
+        emu_stdout->put(buf[i], emu_stdout);
+    }
+    return length;
+}
+
+// receives at the line rate and raises interrupts
+static void interruptLoop()
+{
+    std::deque<uint8_t> line; // sent by the host, not yet shifted in
+    auto next_rx = Clock::now();
+
+    while (true)
+    {
+        if (line.empty())
+        {
+            uint8_t buf[256];
+            const ssize_t n = ::read(uart_fd, buf, sizeof(buf));
+            if (n > 0)
+            {
+                line.insert(line.end(), buf, buf + n);
+            }
+        }
+
+        const auto now = Clock::now();
+        if (!line.empty() && now >= next_rx)
+        {
+            std::lock_guard<std::mutex> lock(uart_mutex);
+            if (uart_baud)
+            {
+                if (rx_fifo.size() < RX_FIFO_DEPTH)
+                {
+                    rx_fifo.push_back(line.front());
+                }
+                else
+                {
+                    rx_overrun = true;
+                    rx_overruns++;
+                }
+                line.pop_front();
+                rx_bytes++;
+                next_rx = std::max(next_rx + char_time, now - char_time);
+            }
+        }
+
+        bool rx_ready;
+        {
+            std::lock_guard<std::mutex> lock(uart_mutex);
+            rx_ready = !rx_fifo.empty();
+        }
+        if (rx_ready && (regs[EMU_UCSRB] & RXCIE))
+        {
+            std::lock_guard<std::mutex> lock(irq_mutex);
+            USART_RXC_vect();
+        }
+        if ((regs[EMU_TIMSK] & TOIE1) && overflowPending())
+        {
+            std::lock_guard<std::mutex> lock(irq_mutex);
+            overflows_delivered++;
+            TIMER1_OVF_vect();
+        }
+
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+    }
+}
+
+void emu_start(int master, unsigned baud)
+{
+    uart_fd = master;
+    if (baud)
+    {
+        setBaud(baud);
+    }
+
+    // interrupts are disabled out of reset
+    irq_mutex.lock();
+
+    std::thread(interruptLoop).detach();
+}
+
+EmuStats emu_stats(void)
+{
+    return EmuStats{rx_bytes, tx_bytes, rx_overruns, bus_contention, tx_faults};
+}
+
+void emu_setTxFaults(uint64_t drop_at, uint64_t drop_length, uint64_t flip_at)
+{
+    tx_drop_at = drop_at;
+    tx_drop_length = drop_length;
+    tx_flip_at = flip_at;
+}
+
+void emu_setChips(size_t count)
+{
+    chips.clear();
+    for (size_t i = 0; i < count && i < EMU_MAX_CHIPS; i++)
+    {
+        chips.push_back(std::make_unique<SST39SF>());
+    }
+}
+
+size_t emu_chips(void)
+{
+    return chips.size();
+}
+
+SST39SF& emu_chip(size_t index)
+{
+    return *chips.at(index);
+}
@@ -0,0 +1,37 @@
+#ifndef EMU_HPP_INCLUDED
+#define EMU_HPP_INCLUDED
+
+#include "sst39sf.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+// firmware's main(), renamed for the host build
+int firmware_main(void);
+
+/* Start the models on a pty master. baud 0 takes the rate the firmware programs into UBRR.
+   Must be called on the thread that then runs the firmware, interrupts start disabled like after reset. */
+void emu_start(int master, unsigned baud);
+
+struct EmuStats
+{
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+    uint64_t rx_overruns; // bytes lost because the firmware didn't read UDR in time
+    uint64_t bus_contention; // data bus reads with more than one driver
+    uint64_t tx_faults; // bytes dropped or corrupted on the way out by emu_setTxFaults
+};
+
+EmuStats emu_stats(void);
+
+// Line faults on what the firmware sends, bytes counted from 1: drop_length bytes from the drop_at-th
+// on are lost and the flip_at-th byte has its low bit flipped. 0 for none. Set up before emu_start
+void emu_setTxFaults(uint64_t drop_at, uint64_t drop_length, uint64_t flip_at);
+
+// Chips on the bus, chip n on the firmware's n-th CE line (PD5, PD2). Set up before emu_start
+static constexpr size_t EMU_MAX_CHIPS = 2;
+void emu_setChips(size_t count);
+size_t emu_chips(void);
+SST39SF& emu_chip(size_t index);
+
+#endif // EMU_HPP_INCLUDED
@@ -0,0 +1,56 @@
+#ifndef EMU_IO_HPP_INCLUDED
+#define EMU_IO_HPP_INCLUDED
+
+#include <cstdint>
+
+// ATmega32 I/O registers the firmware touches, backed by the emulator's models
+enum EmuRegister
+{
+    EMU_PORTA, EMU_PORTB, EMU_PORTC, EMU_PORTD,
+    EMU_PINA, EMU_PINB, EMU_PINC, EMU_PIND,
+    EMU_DDRA, EMU_DDRB, EMU_DDRC, EMU_DDRD,
+    EMU_UCSRA, EMU_UCSRB, EMU_UCSRC, EMU_UBRRL, EMU_UBRRH, EMU_UDR,
+    EMU_TCCR1A, EMU_TCCR1B, EMU_TIMSK, EMU_TIFR,
+    EMU_SREG,
+    EMU_REGISTER_COUNT
+};
+
+uint8_t emu_read(EmuRegister reg);
+void emu_write(EmuRegister reg, uint8_t value);
+uint16_t emu_readTimer(void);
+
+// 8bit register, every access goes through the models like a volatile I/O access would
+struct EmuReg8
+{
+    EmuRegister reg;
+
+    operator uint8_t() const { return emu_read(reg); }
+    const EmuReg8& operator=(uint8_t value) const { emu_write(reg, value); return *this; }
+    const EmuReg8& operator|=(uint8_t value) const { emu_write(reg, emu_read(reg) | value); return *this; }
+    const EmuReg8& operator&=(uint8_t value) const { emu_write(reg, emu_read(reg) & value); return *this; }
+};
+
+struct EmuTimer16
+{
+    operator uint16_t() const { return emu_readTimer(); }
+};
+
+// interrupt vectors the firmware may define
+void USART_RXC_vect(void);
+void TIMER1_OVF_vect(void);
+
+void emu_cli(void);
+void emu_sei(void);
+
+// avr-libc stream, only the put function is used
+struct emu_file
+{
+    int (*put)(char, emu_file*);
+};
+extern emu_file* emu_stdout;
+int emu_printf(const char* format, ...);
+
+// inline assembly in the firmware is only ever nops, they are counted as CPU cycles
+void emu_asm(const char* code);
+
+#endif // EMU_IO_HPP_INCLUDED
@@ -0,0 +1,122 @@
+#include "sst39sf.hpp"
+
+#include <algorithm>
+
+// typical times from the SST39SF0x0A datasheet
+static constexpr std::chrono::microseconds BYTE_PROGRAM_TIME(14);
+static constexpr std::chrono::milliseconds SECTOR_ERASE_TIME(18);
+static constexpr std::chrono::milliseconds CHIP_ERASE_TIME(70);
+
+static constexpr uint32_t SECTOR_SIZE = 0x1000;
+
+SST39SF::SST39SF(uint32_t size, uint8_t device_id)
+    : flash_(size, 0xff), mask_(size - 1), device_id_(device_id)
+{
+}
+
+void SST39SF::write(uint32_t address, uint8_t data)
+{
+    // the chip ignores the bus until an internal operation has finished
+    if (busy())
+    {
+        return;
+    }
+
+    address &= mask_;
+    const uint32_t command_address = address & 0x7fff; // A14-A0 decode the command cycles
+
+    switch (state_)
+    {
+        case State::Idle:
+            if (command_address == 0x5555 && data == 0xaa)
+            {
+                state_ = State::Unlock1;
+            }
+            else if (data == 0xf0)
+            {
+                id_mode_ = false;
+            }
+            return;
+
+        case State::Unlock1:
+            state_ = (command_address == 0x2aaa && data == 0x55) ? State::Unlock2 : State::Idle;
+            return;
+
+        case State::Unlock2:
+            state_ = State::Idle;
+            if (command_address != 0x5555)
+            {
+                return;
+            }
+            if (data == 0xa0)
+            {
+                state_ = State::Program;
+            }
+            else if (data == 0x80)
+            {
+                state_ = State::EraseSetup;
+            }
+            else if (data == 0x90)
+            {
+                id_mode_ = true;
+            }
+            else if (data == 0xf0)
+            {
+                id_mode_ = false;
+            }
+            return;
+
+        case State::Program:
+            state_ = State::Idle;
+            flash_[address] &= data; // programming can only clear bits
+            busy_dq7_ = ~data & 0x80;
+            busy_until_ = Clock::now() + BYTE_PROGRAM_TIME;
+            programs++;
+            return;
+
+        case State::EraseSetup:
+            state_ = (command_address == 0x5555 && data == 0xaa) ? State::EraseUnlock1 : State::Idle;
+            return;
+
+        case State::EraseUnlock1:
+            state_ = (command_address == 0x2aaa && data == 0x55) ? State::EraseUnlock2 : State::Idle;
+            return;
+
+        case State::EraseUnlock2:
+            state_ = State::Idle;
+            busy_dq7_ = 0;
+            if (data == 0x30)
+            {
+                const uint32_t sector = address & ~(SECTOR_SIZE - 1);
+                std::fill_n(flash_.begin() + sector, SECTOR_SIZE, 0xff);
+                busy_until_ = Clock::now() + SECTOR_ERASE_TIME;
+                sector_erases++;
+            }
+            else if (data == 0x10 && command_address == 0x5555)
+            {
+                std::fill(flash_.begin(), flash_.end(), 0xff);
+                busy_until_ = Clock::now() + CHIP_ERASE_TIME;
+                chip_erases++;
+            }
+            return;
+    }
+}
+
+uint8_t SST39SF::read(uint32_t address)
+{
+    if (busy())
+    {
+        // status read: DQ7 data polling, DQ6 toggles on every read
+        toggle_ ^= 0x40;
+        return busy_dq7_ | toggle_;
+    }
+
+    address &= mask_;
+
+    if (id_mode_)
+    {
+        return (address & 1) ? device_id_ : 0xbf;
+    }
+
+    return flash_[address];
+}
@@ -0,0 +1,46 @@
+#ifndef SST39SF_HPP_INCLUDED
+#define SST39SF_HPP_INCLUDED
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+/* Behavioural model of an SST39SF010A/020A/040 flash chip: software command sequences,
+   byte program, sector and chip erase with their typical busy times, data polling on DQ7,
+   toggling DQ6 while busy and the software ID mode. */
+class SST39SF
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit SST39SF(uint32_t size = 0x40000, uint8_t device_id = 0xb6);
+
+    // bus cycles, the address is the full address bus
+    void write(uint32_t address, uint8_t data);
+    uint8_t read(uint32_t address);
+
+    bool busy() const { return Clock::now() < busy_until_; }
+
+    std::vector<uint8_t>& contents() { return flash_; }
+
+    // operation counts for reports
+    uint64_t programs = 0;
+    uint64_t sector_erases = 0;
+    uint64_t chip_erases = 0;
+
+private:
+    enum class State { Idle, Unlock1, Unlock2, Program, EraseSetup, EraseUnlock1, EraseUnlock2 };
+
+    std::vector<uint8_t> flash_;
+    const uint32_t mask_;
+    const uint8_t device_id_;
+
+    State state_ = State::Idle;
+    bool id_mode_ = false;
+
+    Clock::time_point busy_until_;
+    uint8_t busy_dq7_ = 0; // DQ7 while busy, complement of the programmed bit or 0 for erase
+    uint8_t toggle_ = 0;
+};
+
+#endif // SST39SF_HPP_INCLUDED
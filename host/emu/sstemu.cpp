@@ -0,0 +1,250 @@
+// The programmer firmware running on the host against an emulated SST39SF020A, reachable on a pty
+#include "emu.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+static void usage()
+{
+    std::fprintf(stderr,
+        "usage: sstemu [-b BAUD] [--chips N] [--link PATH] [--image FILE] [--report SECONDS]\n"
+        "              [--drop N[:LENGTH]] [--flip N] [-- COMMAND...]\n"
+        "  prints the pty to connect to on the first line of stdout\n"
+        "  -b BAUD           line rate, default is what the firmware programs into UBRR\n"
+        "  --chips N         chips on the bus, for firmware built with SST_CHIPS > 1 (1)\n"
+        "  --link PATH       also make PATH a symlink to the pty\n"
+        "  --image FILE      preload the flash of every chip\n"
+        "  --report SECONDS  print link throughput every SECONDS to stderr\n"
+        "  --drop N[:LENGTH] lose LENGTH (1) bytes the firmware sends, from the Nth on (the first is 1)\n"
+        "  --flip N          flip the low bit of the Nth byte the firmware sends\n"
+        "  -- COMMAND...     run COMMAND with {} replaced by the pty, exit with its status when it ends\n");
+}
+
+static void printStats(double seconds)
+{
+    const EmuStats stats = emu_stats();
+    std::fprintf(stderr, "sstemu: %.1f s, rx %llu bytes (%.0f B/s), tx %llu bytes (%.0f B/s), %llu rx overruns, "
+                 "%llu bus contentions, %llu tx faults\n",
+                 seconds, (unsigned long long)stats.rx_bytes, stats.rx_bytes / seconds,
+                 (unsigned long long)stats.tx_bytes, stats.tx_bytes / seconds,
+                 (unsigned long long)stats.rx_overruns, (unsigned long long)stats.bus_contention,
+                 (unsigned long long)stats.tx_faults);
+    for (size_t i = 0; i < emu_chips(); i++)
+    {
+        const SST39SF& chip = emu_chip(i);
+        std::fprintf(stderr, "sstemu: chip %zu: %llu programs, %llu sector erases, %llu chip erases\n", i,
+                     (unsigned long long)chip.programs, (unsigned long long)chip.sector_erases,
+                     (unsigned long long)chip.chip_erases);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    unsigned baud = 0;
+    std::string link, image;
+    unsigned report = 0;
+    unsigned chips = 1;
+    unsigned long long drop_at = 0, drop_length = 1, flip_at = 0;
+    std::vector<std::string> command;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "-b" && i + 1 < argc)
+        {
+            baud = std::strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--chips" && i + 1 < argc)
+        {
+            chips = std::strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--link" && i + 1 < argc)
+        {
+            link = argv[++i];
+        }
+        else if (arg == "--image" && i + 1 < argc)
+        {
+            image = argv[++i];
+        }
+        else if (arg == "--report" && i + 1 < argc)
+        {
+            report = std::strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--drop" && i + 1 < argc)
+        {
+            char* end = nullptr;
+            drop_at = std::strtoull(argv[++i], &end, 0);
+            if (*end == ':')
+            {
+                drop_length = std::strtoull(end + 1, nullptr, 0);
+            }
+        }
+        else if (arg == "--flip" && i + 1 < argc)
+        {
+            flip_at = std::strtoull(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--" && i + 1 < argc)
+        {
+            command.assign(argv + i + 1, argv + argc);
+            break;
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    if (chips < 1 || chips > EMU_MAX_CHIPS)
+    {
+        std::fprintf(stderr, "sstemu: 1 to %zu chips\n", EMU_MAX_CHIPS);
+        return 2;
+    }
+    emu_setChips(chips);
+    emu_setTxFaults(drop_at, drop_length, flip_at);
+
+    if (!image.empty())
+    {
+        std::ifstream in(image, std::ios::binary);
+        if (!in)
+        {
+            std::fprintf(stderr, "sstemu: can't open %s\n", image.c_str());
+            return 1;
+        }
+        std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        for (size_t i = 0; i < emu_chips(); i++)
+        {
+            auto& flash = emu_chip(i).contents();
+            std::copy_n(data.begin(), std::min(data.size(), flash.size()), flash.begin());
+        }
+    }
+
+    const int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+    {
+        std::perror("sstemu: posix_openpt");
+        return 1;
+    }
+    const std::string path = ptsname(master);
+
+    // keep the slave open so the master never sees a hangup between clients, and make it raw
+    const int slave = ::open(path.c_str(), O_RDWR | O_NOCTTY);
+    termios tio{};
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+    if (!link.empty())
+    {
+        ::unlink(link.c_str());
+        if (::symlink(path.c_str(), link.c_str()) < 0)
+        {
+            std::perror("sstemu: symlink");
+            return 1;
+        }
+    }
+
+    std::printf("%s\n", path.c_str());
+    std::fflush(stdout);
+
+    // a client to run against the pty, started before any thread or signal mask
+    pid_t client = -1;
+    if (!command.empty())
+    {
+        client = fork();
+        if (client == 0)
+        {
+            close(master);
+            close(slave);
+            std::vector<char*> args;
+            for (auto& word : command)
+            {
+                if (word == "{}")
+                {
+                    word = path;
+                }
+                args.push_back(&word[0]);
+            }
+            args.push_back(nullptr);
+            execvp(args[0], args.data());
+            std::fprintf(stderr, "sstemu: can't run %s\n", args[0]);
+            _exit(127);
+        }
+        if (client < 0)
+        {
+            std::perror("sstemu: fork");
+            return 1;
+        }
+    }
+
+    // stats on the way out, signals are handled on their own thread
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    const auto start = std::chrono::steady_clock::now();
+    auto elapsed = [start] { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); };
+
+    std::thread([=] {
+        int sig;
+        sigwait(&signals, &sig);
+        printStats(elapsed());
+        if (!link.empty())
+        {
+            ::unlink(link.c_str());
+        }
+        std::_Exit(0);
+    }).detach();
+
+    if (client > 0)
+    {
+        std::thread([=] {
+            int status = 0;
+            waitpid(client, &status, 0);
+            printStats(elapsed());
+            if (!link.empty())
+            {
+                ::unlink(link.c_str());
+            }
+            std::_Exit(WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+        }).detach();
+    }
+
+    if (report)
+    {
+        std::thread([=] {
+            EmuStats last = emu_stats();
+            while (true)
+            {
+                std::this_thread::sleep_for(std::chrono::seconds(report));
+                const EmuStats now = emu_stats();
+                std::fprintf(stderr, "sstemu: rx %.0f B/s, tx %.0f B/s\n",
+                             double(now.rx_bytes - last.rx_bytes) / report, double(now.tx_bytes - last.tx_bytes) / report);
+                last = now;
+            }
+        }).detach();
+    }
+
+    emu_start(master, baud);
+    firmware_main();
+
+    close(slave);
+    return 0;
+}
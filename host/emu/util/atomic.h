@@ -0,0 +1,20 @@
+#ifndef EMU_UTIL_ATOMIC_H_INCLUDED
+#define EMU_UTIL_ATOMIC_H_INCLUDED
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+// ATOMIC_BLOCK(ATOMIC_RESTORESTATE) as in avr-libc: interrupts off for the block, SREG restored on the way out
+struct EmuAtomicBlock
+{
+    uint8_t sreg = SREG;
+    bool once = true;
+
+    EmuAtomicBlock() { cli(); }
+    ~EmuAtomicBlock() { SREG = sreg; }
+};
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_BLOCK(type) for (EmuAtomicBlock emu_atomic_block; emu_atomic_block.once; emu_atomic_block.once = false)
+
+#endif // EMU_UTIL_ATOMIC_H_INCLUDED
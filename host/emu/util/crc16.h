@@ -0,0 +1,14 @@
+#ifndef EMU_UTIL_CRC16_H_INCLUDED
+#define EMU_UTIL_CRC16_H_INCLUDED
+
+#include <stdint.h>
+
+// same as avr-libc's
+static inline uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data)
+{
+    data ^= (uint8_t)crc;
+    data ^= (uint8_t)(data << 4);
+    return ((((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4) ^ ((uint16_t)data << 3));
+}
+
+#endif // EMU_UTIL_CRC16_H_INCLUDED
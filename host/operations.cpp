@@ -0,0 +1,424 @@
+#include "operations.hpp"
+#include "crc.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <stdexcept>
+#include <string>
+
+static constexpr uint16_t READ_CHUNK = 1024;
+static constexpr unsigned CRCS_PER_BATCH = 16;
+static constexpr unsigned CHUNK_RETRIES = 5;
+
+// a dump chunk reply is the chunk and a few bytes of framing, 10 bits a byte on the line
+static std::chrono::milliseconds chunkTimeout(unsigned baud)
+{
+    const uint64_t bits = (DUMP_CHUNK_SIZE + 16) * 10ull;
+    return std::chrono::milliseconds(3 * bits * 1000 / baud + 200);
+}
+
+bool Confirmed::add(uint32_t address, uint32_t end)
+{
+    done_[address] = end;
+    bool moved = false;
+    for (auto it = done_.find(next_); it != done_.end(); it = done_.find(next_))
+    {
+        next_ = it->second;
+        done_.erase(it);
+        moved = true;
+    }
+    return moved;
+}
+
+static std::string hex(uint32_t value)
+{
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "0x%05x", value);
+    return buf;
+}
+
+void readRange(Device& device, uint32_t start, uint32_t end,
+               const std::function<void(uint32_t address, const std::vector<uint8_t>& data)>& on_data,
+               const ConfirmedFn& on_confirmed)
+{
+    Confirmed confirmed(start);
+
+    std::deque<uint32_t> sent; // chunk addresses in request order
+    std::deque<uint32_t> retry;
+    uint32_t next = start;
+
+    while (next < end || !retry.empty() || !sent.empty())
+    {
+        const bool more = !retry.empty() || next < end;
+        if (more && device.canSend(Device::gatherRequest(0, 0).size()))
+        {
+            uint32_t address = next;
+            if (!retry.empty())
+            {
+                address = retry.front();
+                retry.pop_front();
+            }
+            else
+            {
+                next += std::min<uint32_t>(READ_CHUNK, end - next);
+            }
+            device.send(Device::gatherRequest(address, std::min<uint32_t>(READ_CHUNK, end - address)));
+            sent.push_back(address);
+            continue;
+        }
+
+        const uint32_t address = sent.front();
+        sent.pop_front();
+        const Reply reply = device.receive();
+        if (!reply.ok && reply.frame.empty())
+        {
+            throw std::runtime_error("device rejected the read at " + hex(address));
+        }
+        if (!reply.ok)
+        {
+            // corrupt on the wire, ask again
+            retry.push_back(address);
+            continue;
+        }
+
+        const auto runs = Device::decodeGather(reply);
+        if (runs.size() != 1 || runs[0].address != address)
+        {
+            throw std::runtime_error("unexpected gather reply");
+        }
+        on_data(address, runs[0].data);
+
+        if (confirmed.add(address, address + runs[0].data.size()) && on_confirmed)
+        {
+            on_confirmed(confirmed.next());
+        }
+    }
+}
+
+ChunkStats dumpChunks(Device& device, uint32_t start, uint32_t end,
+                      const std::function<void(uint32_t address, const std::vector<uint8_t>& data)>& on_data,
+                      const ConfirmedFn& on_confirmed)
+{
+    ChunkStats stats;
+    if (start >= end)
+    {
+        return stats;
+    }
+
+    Confirmed confirmed(start);
+
+    const uint16_t last = (end - 1) / DUMP_CHUNK_SIZE;
+    uint16_t next = start / DUMP_CHUNK_SIZE;
+    std::deque<uint16_t> sent;
+    std::deque<uint16_t> retry;
+    std::map<uint16_t, unsigned> attempts;
+    const auto timeout = chunkTimeout(device.baud());
+
+    // corrupt or lost on the wire, ask again
+    auto again = [&](uint16_t chunk, const char* what)
+    {
+        if (++attempts[chunk] > CHUNK_RETRIES)
+        {
+            throw std::runtime_error("dump chunk " + std::to_string(chunk) + " keeps arriving " + what);
+        }
+        stats.retries++;
+        retry.push_back(chunk);
+    };
+
+    while (next <= last || !retry.empty() || !sent.empty())
+    {
+        // retransmissions go out once the pipeline has drained, so each is a request of its own
+        const bool more = (!retry.empty() && sent.empty()) || (retry.empty() && next <= last);
+        if (more && device.canSend(Device::chunkRequest(0).size()))
+        {
+            uint16_t chunk = next;
+            if (!retry.empty())
+            {
+                chunk = retry.front();
+                retry.pop_front();
+            }
+            else
+            {
+                next++;
+            }
+            device.send(Device::chunkRequest(chunk));
+            sent.push_back(chunk);
+            continue;
+        }
+
+        uint16_t chunk = sent.front();
+        sent.pop_front();
+        Reply reply;
+        if (!device.tryReceive(reply, timeout))
+        {
+            // the frame start was lost, there's nothing behind it to give it away
+            device.abandon();
+            again(chunk, "lost");
+            continue;
+        }
+        if (!reply.ok && reply.frame.empty())
+        {
+            throw std::runtime_error("device rejected dump chunk " + std::to_string(chunk));
+        }
+        if (!reply.ok)
+        {
+            again(chunk, "corrupt");
+            continue;
+        }
+
+        const DumpChunk dumped = Device::decodeChunk(reply);
+        if (dumped.number != chunk)
+        {
+            // a later chunk, the ones before it were lost
+            const auto it = std::find(sent.begin(), sent.end(), dumped.number);
+            if (it == sent.end())
+            {
+                throw std::runtime_error("dump chunk " + std::to_string(dumped.number) + " arrived for " + std::to_string(chunk) + ", stale replies from an earlier client?");
+            }
+            again(chunk, "lost");
+            device.abandon();
+            for (auto lost = sent.begin(); lost != it; ++lost)
+            {
+                again(*lost, "lost");
+                device.abandon();
+            }
+            sent.erase(sent.begin(), it + 1);
+            chunk = dumped.number;
+        }
+
+        stats.min_us = stats.chunks ? std::min(stats.min_us, dumped.device_us) : dumped.device_us;
+        stats.max_us = std::max(stats.max_us, dumped.device_us);
+        stats.total_us += dumped.device_us;
+        stats.chunks++;
+
+        // trim the first and last chunk to the range
+        const uint32_t base = uint32_t(chunk) * DUMP_CHUNK_SIZE;
+        const uint32_t from = std::max(start, base);
+        const uint32_t to = std::min<uint32_t>(end, base + DUMP_CHUNK_SIZE);
+        on_data(from, std::vector<uint8_t>(dumped.data.begin() + (from - base), dumped.data.begin() + (to - base)));
+
+        if (confirmed.add(from, to) && on_confirmed)
+        {
+            on_confirmed(confirmed.next());
+        }
+    }
+
+    return stats;
+}
+
+void programImage(Device& device, const std::vector<uint8_t>& image, uint32_t start, uint32_t resume,
+                  EraseMode erase, const ConfirmedFn& on_confirmed)
+{
+    const uint32_t end = start + image.size();
+
+    // each batch holds an optional erase and one write record, two batches fit in the device's receive buffer
+    const uint32_t chunk = std::min<uint32_t>(device.window() / 2 > 32 ? device.window() / 2 - 16 : 16, BATCH_MAX_SIZE - 16);
+
+    Confirmed confirmed(resume);
+    std::deque<std::pair<uint32_t, uint32_t>> sent;
+    uint32_t address = resume;
+
+    while (address < end || !sent.empty())
+    {
+        if (address < end)
+        {
+            // chunks never cross a sector boundary, the first chunk of a sector carries its erase
+            const uint32_t chunk_end = std::min<uint32_t>({end, address + chunk, (address / SECTOR_SIZE + 1) * SECTOR_SIZE});
+            std::vector<uint8_t> records;
+
+            if (erase == EraseMode::Chip && address == start)
+            {
+                appendChipErase(records);
+            }
+            if (erase == EraseMode::Sectors && (address % SECTOR_SIZE == 0 || (address == start && resume == start)))
+            {
+                appendSectorErase(records, address / SECTOR_SIZE);
+            }
+
+            const uint8_t* data = &image[address - start];
+            if (!std::all_of(data, data + (chunk_end - address), [](uint8_t b) { return b == 0xff; }))
+            {
+                appendWrite(records, address, data, chunk_end - address);
+            }
+
+            if (records.empty())
+            {
+                // nothing to do on the device for an erased chunk
+                if (confirmed.add(address, chunk_end) && on_confirmed)
+                {
+                    on_confirmed(confirmed.next());
+                }
+                address = chunk_end;
+                continue;
+            }
+
+            const auto request = Device::batchRequest(records);
+            if (device.canSend(request.size()))
+            {
+                device.send(request);
+                sent.emplace_back(address, chunk_end);
+                address = chunk_end;
+                continue;
+            }
+        }
+
+        const auto range = sent.front();
+        sent.pop_front();
+        for (const auto& result : Device::decodeBatch(device.receive()))
+        {
+            if (result.status != BATCH_STATUS_OK)
+            {
+                throw std::runtime_error("programming failed at " + hex(range.first));
+            }
+        }
+
+        if (confirmed.add(range.first, range.second) && on_confirmed)
+        {
+            on_confirmed(confirmed.next());
+        }
+    }
+}
+
+std::vector<Mismatch> verifyImage(Device& device, const std::vector<uint8_t>& image, uint32_t start,
+                                  const ConfirmedFn& on_progress)
+{
+    const uint32_t end = start + image.size();
+    std::vector<Mismatch> bad;
+
+    uint32_t address = start;
+    while (address < end)
+    {
+        std::vector<uint8_t> records;
+        std::vector<std::pair<uint32_t, uint32_t>> ranges;
+        for (unsigned i = 0; i < CRCS_PER_BATCH && address < end; i++)
+        {
+            const uint32_t length = std::min(end, (address / SECTOR_SIZE + 1) * SECTOR_SIZE) - address;
+            appendCrc(records, address, length);
+            ranges.emplace_back(address, length);
+            address += length;
+        }
+
+        const auto results = device.batch(records, std::chrono::seconds(10));
+        if (results.size() != ranges.size())
+        {
+            throw std::runtime_error("crc batch failed");
+        }
+        for (size_t i = 0; i < ranges.size(); i++)
+        {
+            const uint16_t expected = crc16(&image[ranges[i].first - start], ranges[i].second);
+            if (results[i].value != expected)
+            {
+                bad.push_back({ranges[i].first, ranges[i].second, results[i].value, expected});
+            }
+        }
+        if (on_progress)
+        {
+            on_progress(address);
+        }
+    }
+
+    return bad;
+}
+
+static void checkResults(const std::vector<BatchResult>& results, size_t expected, const char* what)
+{
+    if (results.size() != expected)
+    {
+        throw std::runtime_error(std::string(what) + " failed");
+    }
+    for (const auto& result : results)
+    {
+        if (result.status != BATCH_STATUS_OK)
+        {
+            throw std::runtime_error(std::string(what) + " failed");
+        }
+    }
+}
+
+void eraseChip(Device& device)
+{
+    std::vector<uint8_t> records;
+    appendChipErase(records);
+    checkResults(device.batch(records, std::chrono::seconds(30)), 1, "chip erase");
+}
+
+void eraseSectors(Device& device, const std::vector<uint8_t>& sectors)
+{
+    std::vector<uint8_t> records;
+    for (const uint8_t sector : sectors)
+    {
+        appendSectorErase(records, sector);
+    }
+    checkResults(device.batch(records, std::chrono::seconds(30)), sectors.size(), "sector erase");
+}
+
+uint16_t readCrc(Device& device, uint32_t address, uint32_t length)
+{
+    std::vector<uint8_t> records;
+    appendCrc(records, address, length);
+    const auto results = device.batch(records, std::chrono::seconds(120));
+    checkResults(results, 1, "crc");
+    return results[0].value;
+}
+
+std::vector<uint16_t> readSectorCrcs(Device& device, const std::vector<uint8_t>& sectors)
+{
+    std::vector<uint16_t> crcs;
+    for (size_t first = 0; first < sectors.size(); first += CRCS_PER_BATCH)
+    {
+        const size_t last = std::min<size_t>(sectors.size(), first + CRCS_PER_BATCH);
+        std::vector<uint8_t> records;
+        for (size_t i = first; i < last; i++)
+        {
+            appendCrc(records, sectors[i] * SECTOR_SIZE, SECTOR_SIZE);
+        }
+        const auto results = device.batch(records, std::chrono::seconds(10));
+        checkResults(results, last - first, "crc");
+        for (const auto& result : results)
+        {
+            crcs.push_back(result.value);
+        }
+    }
+    return crcs;
+}
+
+uint16_t copySector(Device& device, uint8_t source, uint8_t destination)
+{
+    std::vector<uint8_t> records;
+    appendSectorErase(records, destination);
+    appendCopy(records, source, destination);
+    const auto results = device.batch(records, std::chrono::seconds(30));
+    checkResults(results, 2, "sector copy");
+    return results[1].value;
+}
+
+uint16_t fillRange(Device& device, uint32_t address, uint32_t length, uint8_t pattern, uint8_t seed)
+{
+    if (!length || address >= CHIP_SIZE || length > CHIP_SIZE - address)
+    {
+        throw std::out_of_range("fill outside of the chip");
+    }
+
+    const uint32_t first = address / SECTOR_SIZE;
+    const uint32_t last = (address + length - 1) / SECTOR_SIZE;
+
+    std::vector<uint8_t> records;
+    for (uint32_t sector = first; sector <= last; sector++)
+    {
+        appendSectorErase(records, sector);
+    }
+    appendFill(records, address, length, pattern, seed);
+
+    // roughly 25ms per erase and 25us per byte, with plenty to spare
+    const std::chrono::milliseconds timeout(10000 + (last - first + 1) * 50 + length / 20);
+    const auto results = device.batch(records, timeout);
+    checkResults(results, last - first + 2, "fill");
+    return results.back().value;
+}
+
+void selectChips(Device& device, uint8_t chips)
+{
+    std::vector<uint8_t> records;
+    appendSelect(records, chips);
+    checkResults(device.batch(records, std::chrono::seconds(5)), 1, "chip select");
+}
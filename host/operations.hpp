@@ -0,0 +1,89 @@
+#ifndef OPERATIONS_HPP_INCLUDED
+#define OPERATIONS_HPP_INCLUDED
+
+#include "device.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+
+static constexpr uint32_t CHIP_SIZE = 0x40000; // ADDR_MASK + 1
+static constexpr uint32_t SECTOR_SIZE = 0x1000;
+
+// called with the end of the range the device has confirmed so far
+using ConfirmedFn = std::function<void(uint32_t next)>;
+
+// Tracks which pieces of a pipelined job are confirmed, a checkpoint is the end of the confirmed prefix
+class Confirmed
+{
+public:
+    explicit Confirmed(uint32_t from) : next_(from) {}
+
+    // returns true if the prefix moved
+    bool add(uint32_t address, uint32_t end);
+    uint32_t next() const { return next_; }
+
+private:
+    uint32_t next_;
+    std::map<uint32_t, uint32_t> done_;
+};
+
+// Read start..end with pipelined gather requests, chunks that arrive corrupt are asked for again
+void readRange(Device& device, uint32_t start, uint32_t end,
+               const std::function<void(uint32_t address, const std::vector<uint8_t>& data)>& on_data,
+               const ConfirmedFn& on_confirmed);
+
+struct ChunkStats
+{
+    unsigned chunks = 0;
+    unsigned retries = 0;
+    uint32_t min_us = 0; // device time per chunk
+    uint32_t max_us = 0;
+    uint64_t total_us = 0;
+};
+
+// Read start..end as numbered dump chunks (DUMP_CHUNK_SIZE in protocol.h), trimmed to the range before on_data.
+// A chunk that arrives corrupt is asked for again on its own, up to a few times before giving up
+ChunkStats dumpChunks(Device& device, uint32_t start, uint32_t end,
+                      const std::function<void(uint32_t address, const std::vector<uint8_t>& data)>& on_data,
+                      const ConfirmedFn& on_confirmed);
+
+enum class EraseMode
+{
+    Sectors, // erase each sector just before its first byte is written
+    Chip, // chip erase before the first write
+    None // the chip has been erased already
+};
+
+// Program image at start, resume is start for a fresh job or a checkpoint to continue from
+void programImage(Device& device, const std::vector<uint8_t>& image, uint32_t start, uint32_t resume,
+                  EraseMode erase, const ConfirmedFn& on_confirmed);
+
+struct Mismatch
+{
+    uint32_t address;
+    uint32_t length;
+    uint16_t device_crc;
+    uint16_t image_crc;
+};
+
+// compare per-sector crcs of the chip against image placed at start
+std::vector<Mismatch> verifyImage(Device& device, const std::vector<uint8_t>& image, uint32_t start,
+                                  const ConfirmedFn& on_progress);
+
+void eraseChip(Device& device);
+void eraseSectors(Device& device, const std::vector<uint8_t>& sectors);
+uint16_t readCrc(Device& device, uint32_t address, uint32_t length);
+// crc of each sector in the list, in the same order
+std::vector<uint16_t> readSectorCrcs(Device& device, const std::vector<uint8_t>& sectors);
+
+// On-device sector copy and pattern fill (FILL_* in protocol.h). The destination is erased first,
+// for fill every sector the range touches. Both return the crc the device read back from the result
+uint16_t copySector(Device& device, uint8_t source, uint8_t destination);
+uint16_t fillRange(Device& device, uint32_t address, uint32_t length, uint8_t pattern, uint8_t seed);
+
+// Gang programming: writes and erases go to every chip in the mask (bit n is chip n), reads to the lowest
+void selectChips(Device& device, uint8_t chips);
+
+#endif // OPERATIONS_HPP_INCLUDED
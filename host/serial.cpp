@@ -0,0 +1,118 @@
+#include "serial.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+static speed_t baudConstant(unsigned baud)
+{
+    switch (baud)
+    {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        default: throw std::runtime_error("unsupported baud rate " + std::to_string(baud));
+    }
+}
+
+static std::runtime_error systemError(const std::string& what)
+{
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+SerialPort::SerialPort(const std::string& path, unsigned baud)
+    : path_(path)
+{
+    fd_ = ::open(path.c_str(), O_RDWR | O_NOCTTY);
+    if (fd_ < 0)
+    {
+        throw systemError("open " + path);
+    }
+
+    termios tio{};
+    if (tcgetattr(fd_, &tio) < 0)
+    {
+        ::close(fd_);
+        throw systemError("tcgetattr " + path);
+    }
+
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, baudConstant(baud));
+    cfsetospeed(&tio, baudConstant(baud));
+
+    if (tcsetattr(fd_, TCSANOW, &tio) < 0)
+    {
+        ::close(fd_);
+        throw systemError("tcsetattr " + path);
+    }
+
+    tcflush(fd_, TCIOFLUSH);
+}
+
+SerialPort::~SerialPort()
+{
+    ::close(fd_);
+}
+
+void SerialPort::write(const uint8_t* buf, size_t length)
+{
+    while (length)
+    {
+        const ssize_t n = ::write(fd_, buf, length);
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+            {
+                continue;
+            }
+            throw systemError("write " + path_);
+        }
+        buf += n;
+        length -= static_cast<size_t>(n);
+    }
+}
+
+size_t SerialPort::read(uint8_t* buf, size_t length, int timeout_ms)
+{
+    pollfd pfd{fd_, POLLIN, 0};
+    const int ready = ::poll(&pfd, 1, timeout_ms);
+    if (ready < 0)
+    {
+        if (errno == EINTR)
+        {
+            return 0;
+        }
+        throw systemError("poll " + path_);
+    }
+    if (!ready)
+    {
+        return 0;
+    }
+    if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL) && !(pfd.revents & POLLIN))
+    {
+        throw std::runtime_error(path_ + ": port closed");
+    }
+
+    const ssize_t n = ::read(fd_, buf, length);
+    if (n < 0)
+    {
+        if (errno == EINTR || errno == EAGAIN)
+        {
+            return 0;
+        }
+        throw systemError("read " + path_);
+    }
+    return static_cast<size_t>(n);
+}
@@ -0,0 +1,30 @@
+#ifndef SERIAL_HPP_INCLUDED
+#define SERIAL_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Raw 8N1 serial port (or pseudo-terminal), closed on destruction
+class SerialPort
+{
+public:
+    SerialPort(const std::string& path, unsigned baud);
+    ~SerialPort();
+
+    SerialPort(const SerialPort&) = delete;
+    SerialPort& operator=(const SerialPort&) = delete;
+
+    void write(const uint8_t* buf, size_t length);
+
+    // wait up to timeout_ms for data, returns the number of bytes read (0 on timeout)
+    size_t read(uint8_t* buf, size_t length, int timeout_ms);
+
+    const std::string& path() const { return path_; }
+
+private:
+    std::string path_;
+    int fd_;
+};
+
+#endif // SERIAL_HPP_INCLUDED
@@ -0,0 +1,532 @@
+// Command line client for the avr-eeprom-sst programmer
+#include "cache.hpp"
+#include "crc.hpp"
+#include "device.hpp"
+#include "operations.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct Options
+{
+    std::string port;
+    unsigned baud = 57600;
+    size_t window = Device::DEFAULT_WINDOW;
+    bool restart = false;
+    bool chip_erase = false;
+    bool verify = false;
+    uint8_t chips = 0; // 0 leaves the device's selection alone
+    std::string cache; // content cache directory, empty for none
+    CacheFill cache_fill = CacheFill::ReadBack;
+    std::vector<std::string> args;
+};
+
+static void usage()
+{
+    std::cerr <<
+        "usage: sstflash -p PORT [-b BAUD] [-w WINDOW] [--chips MASK] [--cache DIR [--no-cache-fill]] [--restart] COMMAND\n"
+        "  dump FILE [START [LENGTH]]      read the chip into FILE\n"
+        "  program FILE [START] [--chip-erase] [--verify]\n"
+        "                                  write FILE, erasing every sector it touches (or the whole chip)\n"
+        "  verify FILE [START]             compare sector crcs against FILE\n"
+        "  erase all|SECTOR...             chip or sector erase\n"
+        "  crc START LENGTH                crc16 of a range\n"
+        "  copy SOURCE DESTINATION         copy a sector on the device, erasing the destination\n"
+        "  fill START LENGTH constant|increment|random [SEED]\n"
+        "                                  fill a range with a test pattern on the device, erasing every sector it touches\n"
+        "An interrupted dump or program resumes from FILE.ckpt unless --restart is given.\n"
+        "--chips selects chips on a gang programmer (bit n is chip n): program and erase go to all of them,\n"
+        "verify checks each one, dump and crc read the lowest.\n"
+        "--cache keeps the last known contents of each chip in DIR: program then only touches sectors that change,\n"
+        "keeping the chip's bytes around the image, and a whole chip dump seeds the cache. A miss reads the rest of the\n"
+        "chip back to fill its entry, --no-cache-fill skips that and stores nothing.\n";
+}
+
+static uint32_t parseNumber(const std::string& text)
+{
+    size_t end = 0;
+    const unsigned long value = std::stoul(text, &end, 0);
+    if (end != text.size())
+    {
+        throw std::invalid_argument("not a number: " + text);
+    }
+    return static_cast<uint32_t>(value);
+}
+
+static std::vector<uint8_t> loadFile(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        throw std::runtime_error("can't open " + path);
+    }
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// Progress line on stderr, redrawn at most every 100ms
+class Progress
+{
+public:
+    Progress(const std::string& label, uint32_t total)
+        : label_(label), total_(total), start_(std::chrono::steady_clock::now())
+    {
+    }
+
+    void update(uint32_t done, bool force = false)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        if (!force && now - last_ < std::chrono::milliseconds(100))
+        {
+            return;
+        }
+        last_ = now;
+
+        const double seconds = std::chrono::duration<double>(now - start_).count();
+        const double rate = seconds > 0 ? (done - first_) / seconds : 0;
+        std::fprintf(stderr, "\r%s %6u/%u bytes %5.1f%% %7.0f B/s", label_.c_str(), done, total_,
+                     total_ ? 100.0 * done / total_ : 100.0, rate);
+        if (force)
+        {
+            std::fputc('\n', stderr);
+        }
+    }
+
+    // count throughput only from here, for resumed jobs
+    void resumeAt(uint32_t done) { first_ = done; }
+
+private:
+    std::string label_;
+    uint32_t total_;
+    uint32_t first_ = 0;
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::steady_clock::time_point last_;
+};
+
+/* Resume point of a dump or program job, kept next to its file as
+    sstflash OP START LENGTH CRC NEXT
+   CRC identifies the image for program jobs so a changed file starts over. */
+class Checkpoint
+{
+public:
+    Checkpoint(const std::string& file, const std::string& op, uint32_t start, uint32_t length, uint16_t crc)
+        : path_(file + ".ckpt"), op_(op), start_(start), length_(length), crc_(crc)
+    {
+    }
+
+    // address to continue from
+    uint32_t load() const
+    {
+        std::ifstream in(path_);
+        std::string magic, op;
+        uint32_t start, length, crc, next;
+        if (in >> magic >> op >> start >> length >> crc >> next &&
+            magic == "sstflash" && op == op_ && start == start_ && length == length_ && crc == crc_ &&
+            next >= start && next <= start + length)
+        {
+            return next;
+        }
+        return start_;
+    }
+
+    void save(uint32_t next) const
+    {
+        const std::string tmp = path_ + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            out << "sstflash " << op_ << ' ' << start_ << ' ' << length_ << ' ' << crc_ << ' ' << next << '\n';
+        }
+        std::rename(tmp.c_str(), path_.c_str());
+    }
+
+    void remove() const { std::remove(path_.c_str()); }
+
+private:
+    std::string path_;
+    std::string op_;
+    uint32_t start_;
+    uint32_t length_;
+    uint16_t crc_;
+};
+
+static int dump(Device& device, const Options& opt)
+{
+    if (opt.args.size() < 2)
+    {
+        usage();
+        return 2;
+    }
+    const std::string& file = opt.args[1];
+    const uint32_t start = opt.args.size() > 2 ? parseNumber(opt.args[2]) : 0;
+    uint32_t length = opt.args.size() > 3 ? parseNumber(opt.args[3]) : CHIP_SIZE - start;
+    if (start >= CHIP_SIZE)
+    {
+        throw std::out_of_range("start beyond the end of the chip");
+    }
+    if (length > CHIP_SIZE - start)
+    {
+        length = CHIP_SIZE - start;
+    }
+    const uint32_t end = start + length;
+
+    Checkpoint checkpoint(file, "dump", start, length, 0);
+    const uint32_t resume = opt.restart ? start : checkpoint.load();
+
+    std::fstream out(file, std::ios::binary | std::ios::in | std::ios::out | (resume == start ? std::ios::trunc : std::ios::openmode()));
+    if (!out)
+    {
+        out.open(file, std::ios::binary | std::ios::out | std::ios::trunc);
+    }
+    if (!out)
+    {
+        throw std::runtime_error("can't write " + file);
+    }
+
+    Progress progress("dump", length);
+    progress.resumeAt(resume - start);
+
+    const ChunkStats stats = dumpChunks(device, resume, end,
+        [&](uint32_t address, const std::vector<uint8_t>& data)
+        {
+            out.seekp(address - start);
+            out.write(reinterpret_cast<const char*>(data.data()), data.size());
+        },
+        [&](uint32_t next)
+        {
+            out.flush();
+            checkpoint.save(next);
+            progress.update(next - start);
+        });
+
+    progress.update(length, true);
+    checkpoint.remove();
+
+    if (stats.chunks)
+    {
+        std::fprintf(stderr, "%u chunks, device time min %u avg %llu max %u us, %u retransmitted\n",
+                     stats.chunks, stats.min_us, (unsigned long long)(stats.total_us / stats.chunks),
+                     stats.max_us, stats.retries);
+    }
+
+    if (!opt.cache.empty() && start == 0 && length == CHIP_SIZE)
+    {
+        out.close();
+        ContentCache(opt.cache).store(loadFile(file));
+    }
+    return 0;
+}
+
+static int reportVerify(Device& device, const std::vector<uint8_t>& image, uint32_t start, const std::string& label)
+{
+    Progress progress(label, image.size());
+    const auto bad = verifyImage(device, image, start, [&](uint32_t next) { progress.update(next - start); });
+    progress.update(image.size(), true);
+
+    for (const auto& m : bad)
+    {
+        std::fprintf(stderr, "mismatch in sector %u (0x%05x, %u bytes): device crc 0x%04x, file crc 0x%04x\n",
+                     m.address / SECTOR_SIZE, m.address, m.length, m.device_crc, m.image_crc);
+    }
+    if (!bad.empty())
+    {
+        std::fprintf(stderr, "%zu sector(s) differ\n", bad.size());
+    }
+    return bad.empty() ? 0 : 1;
+}
+
+// verify every selected chip on its own, reads only ever come from one
+static int verifyChips(Device& device, const std::vector<uint8_t>& image, uint32_t start, uint8_t chips)
+{
+    if (!chips)
+    {
+        return reportVerify(device, image, start, "verify");
+    }
+
+    int result = 0;
+    for (unsigned chip = 0; chip < 8; chip++)
+    {
+        if (chips & (1 << chip))
+        {
+            selectChips(device, 1 << chip);
+            result |= reportVerify(device, image, start, "verify chip " + std::to_string(chip));
+        }
+    }
+    selectChips(device, chips);
+    return result;
+}
+
+static int program(Device& device, const Options& opt)
+{
+    if (opt.args.size() < 2)
+    {
+        usage();
+        return 2;
+    }
+    const std::string& file = opt.args[1];
+    const uint32_t start = opt.args.size() > 2 ? parseNumber(opt.args[2]) : 0;
+    const std::vector<uint8_t> image = loadFile(file);
+    if (start >= CHIP_SIZE || image.size() > CHIP_SIZE - start)
+    {
+        throw std::out_of_range("image doesn't fit in the chip");
+    }
+
+    if (!opt.cache.empty())
+    {
+        const auto result = programCached(device, ContentCache(opt.cache), image, start, opt.cache_fill);
+        std::fprintf(stderr, "cache %s: %u sector(s) programmed, %u erased, %u bytes sent\n", result.hit ? "hit" : "miss",
+                     result.sectors_programmed, result.sectors_erased, result.bytes_sent);
+        return opt.verify ? verifyChips(device, image, start, opt.chips) : 0;
+    }
+
+    std::string op = opt.chip_erase ? "program-chip-erase" : "program";
+    if (opt.chips)
+    {
+        op += "-chips-" + std::to_string(opt.chips);
+    }
+    Checkpoint checkpoint(file, op, start, image.size(), crc16(image.data(), image.size()));
+    const uint32_t resume = opt.restart ? start : checkpoint.load();
+
+    Progress progress("program", image.size());
+    progress.resumeAt(resume - start);
+
+    programImage(device, image, start, resume, opt.chip_erase ? EraseMode::Chip : EraseMode::Sectors,
+        [&](uint32_t next)
+        {
+            checkpoint.save(next);
+            progress.update(next - start);
+        });
+
+    progress.update(image.size(), true);
+    checkpoint.remove();
+
+    return opt.verify ? verifyChips(device, image, start, opt.chips) : 0;
+}
+
+static int verify(Device& device, const Options& opt)
+{
+    if (opt.args.size() < 2)
+    {
+        usage();
+        return 2;
+    }
+    const uint32_t start = opt.args.size() > 2 ? parseNumber(opt.args[2]) : 0;
+    const std::vector<uint8_t> image = loadFile(opt.args[1]);
+    if (start >= CHIP_SIZE || image.size() > CHIP_SIZE - start)
+    {
+        throw std::out_of_range("image doesn't fit in the chip");
+    }
+    return verifyChips(device, image, start, opt.chips);
+}
+
+static int erase(Device& device, const Options& opt)
+{
+    if (opt.args.size() < 2)
+    {
+        usage();
+        return 2;
+    }
+
+    if (opt.args[1] == "all")
+    {
+        eraseChip(device);
+    }
+    else
+    {
+        std::vector<uint8_t> sectors;
+        for (size_t i = 1; i < opt.args.size(); i++)
+        {
+            const uint32_t sector = parseNumber(opt.args[i]);
+            if (sector >= CHIP_SIZE / SECTOR_SIZE)
+            {
+                throw std::out_of_range("no sector " + opt.args[i]);
+            }
+            sectors.push_back(sector);
+        }
+        eraseSectors(device, sectors);
+    }
+
+    std::printf("DONE\n");
+    return 0;
+}
+
+static int crc(Device& device, const Options& opt)
+{
+    if (opt.args.size() < 3)
+    {
+        usage();
+        return 2;
+    }
+
+    std::printf("0x%04x\n", readCrc(device, parseNumber(opt.args[1]), parseNumber(opt.args[2])));
+    return 0;
+}
+
+static int copy(Device& device, const Options& opt)
+{
+    if (opt.args.size() < 3)
+    {
+        usage();
+        return 2;
+    }
+
+    const uint32_t source = parseNumber(opt.args[1]);
+    const uint32_t destination = parseNumber(opt.args[2]);
+    if (source >= CHIP_SIZE / SECTOR_SIZE || destination >= CHIP_SIZE / SECTOR_SIZE || source == destination)
+    {
+        throw std::out_of_range("bad sector numbers");
+    }
+
+    std::printf("0x%04x\n", copySector(device, source, destination));
+    return 0;
+}
+
+static int fill(Device& device, const Options& opt)
+{
+    if (opt.args.size() < 4)
+    {
+        usage();
+        return 2;
+    }
+
+    const std::string& name = opt.args[3];
+    uint8_t pattern;
+    if (name == "constant")
+    {
+        pattern = FILL_CONSTANT;
+    }
+    else if (name == "increment")
+    {
+        pattern = FILL_INCREMENT;
+    }
+    else if (name == "random")
+    {
+        pattern = FILL_RANDOM;
+    }
+    else
+    {
+        usage();
+        return 2;
+    }
+    const uint8_t seed = opt.args.size() > 4 ? parseNumber(opt.args[4]) : 0;
+
+    std::printf("0x%04x\n", fillRange(device, parseNumber(opt.args[1]), parseNumber(opt.args[2]), pattern, seed));
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if ((arg == "-p" || arg == "-b" || arg == "-w" || arg == "--chips" || arg == "--cache") && i + 1 < argc)
+        {
+            const std::string value = argv[++i];
+            if (arg == "-p")
+            {
+                opt.port = value;
+            }
+            else if (arg == "-b")
+            {
+                opt.baud = parseNumber(value);
+            }
+            else if (arg == "--chips")
+            {
+                opt.chips = parseNumber(value);
+            }
+            else if (arg == "--cache")
+            {
+                opt.cache = value;
+            }
+            else
+            {
+                opt.window = parseNumber(value);
+            }
+        }
+        else if (arg == "--restart")
+        {
+            opt.restart = true;
+        }
+        else if (arg == "--chip-erase")
+        {
+            opt.chip_erase = true;
+        }
+        else if (arg == "--verify")
+        {
+            opt.verify = true;
+        }
+        else if (arg == "--no-cache-fill")
+        {
+            opt.cache_fill = CacheFill::None;
+        }
+        else
+        {
+            opt.args.push_back(arg);
+        }
+    }
+
+    if (opt.port.empty() || opt.args.empty())
+    {
+        usage();
+        return 2;
+    }
+    if (!opt.cache.empty() && (opt.chips & (opt.chips - 1)))
+    {
+        // the fingerprint only sees the lowest chip
+        std::fprintf(stderr, "sstflash: --cache works with one chip at a time\n");
+        return 2;
+    }
+
+    try
+    {
+        Device device(opt.port, opt.baud, opt.window);
+        const std::string& cmd = opt.args[0];
+
+        if (opt.chips)
+        {
+            selectChips(device, opt.chips);
+        }
+
+        if (cmd == "dump")
+        {
+            return dump(device, opt);
+        }
+        else if (cmd == "program")
+        {
+            return program(device, opt);
+        }
+        else if (cmd == "verify")
+        {
+            return verify(device, opt);
+        }
+        else if (cmd == "erase")
+        {
+            return erase(device, opt);
+        }
+        else if (cmd == "crc")
+        {
+            return crc(device, opt);
+        }
+        else if (cmd == "copy")
+        {
+            return copy(device, opt);
+        }
+        else if (cmd == "fill")
+        {
+            return fill(device, opt);
+        }
+
+        usage();
+        return 2;
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "\nsstflash: %s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,615 @@
+// Drives a rack of programmers in parallel, one worker thread per serial port
+#include "cache.hpp"
+#include "crc.hpp"
+#include "device.hpp"
+#include "operations.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    unsigned baud = 57600;
+    size_t window = Device::DEFAULT_WINDOW;
+    unsigned repeat = 1;
+    unsigned transfer_slots = 0; // 0 = one per port
+    unsigned emulate = 0;
+    uint8_t chips = 0; // gang programmer chip mask, 0 for single chip boards
+    std::string cache; // content cache directory, shared by all boards
+    CacheFill cache_fill = CacheFill::ReadBack;
+    bool serial = false;
+    uint32_t serial_offset = 0;
+    uint32_t serial_first = 0;
+    unsigned serial_width = 4;
+    std::vector<std::string> images;
+    std::vector<std::string> ports;
+};
+
+static void usage()
+{
+    std::cerr <<
+        "usage: sstrack [options] -i IMAGE [-i IMAGE...] PORT...\n"
+        "  -b BAUD                   serial speed (57600)\n"
+        "  -w WINDOW                 request bytes queued per device\n"
+        "  --repeat N                program the image list N times\n"
+        "  --serial OFFSET[:FIRST[:WIDTH]]\n"
+        "                            patch a little endian serial number into each job's image\n"
+        "  --chips MASK              program every chip in MASK at once and verify each (bit n is chip n)\n"
+        "  --cache DIR               only reprogram sectors that changed since a chip was last seen\n"
+        "  --no-cache-fill           on a cache miss don't read the rest of the chip back, nothing is stored\n"
+        "  --transfer-slots K        at most K boards transfer at once, the rest erase or verify\n"
+        "  --emulate N               run against N emulated boards (sstemu next to sstrack or on PATH)\n";
+}
+
+static uint32_t parseNumber(const std::string& text)
+{
+    size_t end = 0;
+    const unsigned long value = std::stoul(text, &end, 0);
+    if (end != text.size())
+    {
+        throw std::invalid_argument("not a number: " + text);
+    }
+    return static_cast<uint32_t>(value);
+}
+
+static std::vector<uint8_t> loadFile(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        throw std::runtime_error("can't open " + path);
+    }
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// sstemu child process, one emulated board on a pseudo-terminal
+class EmulatorProcess
+{
+public:
+    EmulatorProcess(const std::string& program, unsigned baud, unsigned chips)
+    {
+        int out[2];
+        if (pipe(out) != 0)
+        {
+            throw std::runtime_error("pipe failed");
+        }
+
+        pid_ = fork();
+        if (pid_ == 0)
+        {
+            dup2(out[1], STDOUT_FILENO);
+            close(out[0]);
+            close(out[1]);
+            const std::string rate = std::to_string(baud);
+            const std::string count = std::to_string(chips);
+            execlp(program.c_str(), program.c_str(), "-b", rate.c_str(), "--chips", count.c_str(),
+                   static_cast<char*>(nullptr));
+            std::fprintf(stderr, "sstrack: can't run %s\n", program.c_str());
+            _exit(127);
+        }
+        close(out[1]);
+        if (pid_ < 0)
+        {
+            close(out[0]);
+            throw std::runtime_error("fork failed");
+        }
+
+        // the first line is the pty path
+        char c;
+        while (read(out[0], &c, 1) == 1 && c != '\n')
+        {
+            path_ += c;
+        }
+        close(out[0]);
+        if (path_.empty())
+        {
+            stop();
+            throw std::runtime_error("no pty from " + program);
+        }
+    }
+
+    ~EmulatorProcess() { stop(); }
+
+    EmulatorProcess(const EmulatorProcess&) = delete;
+    EmulatorProcess& operator=(const EmulatorProcess&) = delete;
+
+    const std::string& path() const { return path_; }
+
+private:
+    void stop()
+    {
+        kill(pid_, SIGTERM);
+        waitpid(pid_, nullptr, 0);
+    }
+
+    pid_t pid_;
+    std::string path_;
+};
+
+// sstemu from the directory sstrack was started from, else from PATH
+static std::string emulatorProgram(const char* argv0)
+{
+    const std::string self = argv0;
+    const size_t slash = self.rfind('/');
+    if (slash != std::string::npos)
+    {
+        const std::string local = self.substr(0, slash + 1) + "sstemu";
+        if (access(local.c_str(), X_OK) == 0)
+        {
+            return local;
+        }
+    }
+    return "sstemu";
+}
+
+static unsigned highestChip(uint8_t chips)
+{
+    unsigned chip = 0;
+    while (chips >>= 1)
+    {
+        chip++;
+    }
+    return chip;
+}
+
+// boards without --chips have one
+static unsigned chipCount(uint8_t chips)
+{
+    unsigned count = 0;
+    for (; chips; chips >>= 1)
+    {
+        count += chips & 1;
+    }
+    return count ? count : 1;
+}
+
+// counting semaphore for the transfer phase
+class Slots
+{
+public:
+    explicit Slots(unsigned count) : free_(count) {}
+
+    void acquire()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return free_ > 0; });
+        free_--;
+    }
+
+    void release()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_++;
+        cv_.notify_one();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    unsigned free_;
+};
+
+struct Job
+{
+    unsigned number;
+    size_t image;
+    uint32_t serial;
+};
+
+// shared between the workers, a job that fails on one board can be handed back for another
+class JobQueue
+{
+public:
+    void push(const Job& job)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back(job);
+    }
+
+    // waits while the queue is empty but jobs running elsewhere might still come back
+    bool pop(Job& job)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return !jobs_.empty() || !running_; });
+        if (jobs_.empty())
+        {
+            return false;
+        }
+        job = jobs_.front();
+        jobs_.pop_front();
+        running_++;
+        return true;
+    }
+
+    // the popped job is finished, done or failed for good
+    void finish()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_--;
+        cv_.notify_all();
+    }
+
+    // the popped job goes back for another board
+    void requeue(const Job& job)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back(job);
+        running_--;
+        cv_.notify_all();
+    }
+
+    size_t left()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return jobs_.size();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Job> jobs_;
+    unsigned running_ = 0;
+};
+
+struct BoardStats
+{
+    std::string port;
+    unsigned done = 0;
+    unsigned failed = 0;
+    unsigned requeued = 0; // failed jobs handed back to the other boards
+    uint64_t bytes = 0;
+    Clock::duration erase{};
+    Clock::duration wait{}; // waiting for a transfer slot
+    Clock::duration program{};
+    Clock::duration verify{};
+    std::string error;
+};
+
+static std::mutex log_mutex;
+
+static void log(const std::string& port, const std::string& text)
+{
+    std::lock_guard<std::mutex> lock(log_mutex);
+    std::fprintf(stderr, "[%s] %s\n", port.c_str(), text.c_str());
+}
+
+static double seconds(Clock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+// phase timer, adds the elapsed time to a counter when it goes out of scope
+class Phase
+{
+public:
+    explicit Phase(Clock::duration& total) : total_(total), start_(Clock::now()) {}
+    ~Phase() { total_ += Clock::now() - start_; }
+
+private:
+    Clock::duration& total_;
+    Clock::time_point start_;
+};
+
+// transfer slot held for as long as it is in scope
+class SlotHold
+{
+public:
+    SlotHold(Slots& slots, Clock::duration& wait) : slots_(slots)
+    {
+        Phase phase(wait);
+        slots_.acquire();
+    }
+    ~SlotHold() { slots_.release(); }
+
+    SlotHold(const SlotHold&) = delete;
+    SlotHold& operator=(const SlotHold&) = delete;
+
+private:
+    Slots& slots_;
+};
+
+// one job on one board, returns the sectors that failed verify
+static std::vector<Mismatch> runJob(Device& device, const Options& opt, const std::vector<uint8_t>& image,
+                                   Slots& slots, BoardStats& stats)
+{
+    std::vector<Mismatch> bad;
+
+    if (!opt.cache.empty())
+    {
+        // checked against the chip crc (only the touched sectors with --no-cache-fill), that is the verify
+        const ContentCache cache(opt.cache);
+        CachedPlan plan;
+        {
+            // the fingerprint and the erases barely use the link
+            Phase phase(stats.erase);
+            plan = planCached(device, cache, image, 0, opt.cache_fill);
+            eraseCached(device, plan);
+        }
+        {
+            SlotHold slot(slots, stats.wait);
+            Phase phase(stats.program);
+            transferCached(device, plan);
+        }
+        {
+            Phase phase(stats.verify);
+            checkCached(device, cache, plan);
+        }
+        return bad;
+    }
+
+    // erasing needs no link bandwidth, it overlaps other boards' transfers
+    {
+        Phase phase(stats.erase);
+        eraseChip(device);
+    }
+
+    {
+        SlotHold slot(slots, stats.wait);
+        Phase phase(stats.program);
+        programImage(device, image, 0, 0, EraseMode::None, nullptr);
+    }
+
+    Phase phase(stats.verify);
+    if (!opt.chips)
+    {
+        return verifyImage(device, image, 0, nullptr);
+    }
+
+    // reads come from one chip at a time
+    for (unsigned chip = 0; chip < 8; chip++)
+    {
+        if (opt.chips & (1 << chip))
+        {
+            selectChips(device, 1 << chip);
+            const auto chip_bad = verifyImage(device, image, 0, nullptr);
+            bad.insert(bad.end(), chip_bad.begin(), chip_bad.end());
+        }
+    }
+    selectChips(device, opt.chips);
+    return bad;
+}
+
+static void worker(const std::string& port, const Options& opt, const std::vector<std::vector<uint8_t>>& images,
+                   JobQueue& queue, Slots& slots, BoardStats& stats)
+{
+    stats.port = port;
+
+    try
+    {
+        Device device(port, opt.baud, opt.window);
+        Job job;
+
+        if (opt.chips)
+        {
+            selectChips(device, opt.chips);
+        }
+
+        while (queue.pop(job))
+        {
+            std::vector<uint8_t> image = images[job.image];
+            if (opt.serial)
+            {
+                for (unsigned i = 0; i < opt.serial_width; i++)
+                {
+                    image[opt.serial_offset + i] = static_cast<uint8_t>(job.serial >> (8 * i));
+                }
+            }
+
+            char text[160];
+            std::vector<Mismatch> bad;
+            try
+            {
+                bad = runJob(device, opt, image, slots, stats);
+            }
+            catch (const std::exception& e)
+            {
+                // the board can't be trusted any more, another one takes the job
+                stats.failed++;
+                stats.requeued++;
+                stats.error = e.what();
+                queue.requeue(job);
+                std::snprintf(text, sizeof(text), "job %u (image %zu, serial %u) failed: %s, requeued, board retired",
+                              job.number, job.image, job.serial, e.what());
+                log(port, text);
+                return;
+            }
+
+            if (bad.empty())
+            {
+                stats.done++;
+                stats.bytes += image.size() * chipCount(opt.chips);
+                std::snprintf(text, sizeof(text), "job %u (image %zu, serial %u) done", job.number, job.image, job.serial);
+            }
+            else
+            {
+                stats.failed++;
+                std::snprintf(text, sizeof(text), "job %u (image %zu, serial %u) failed verify, %zu sector(s) differ",
+                              job.number, job.image, job.serial, bad.size());
+            }
+            log(port, text);
+            queue.finish();
+        }
+    }
+    catch (const std::exception& e)
+    {
+        stats.error = e.what();
+        log(port, std::string("stopped: ") + e.what());
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string arg = argv[i];
+            const bool has_value = i + 1 < argc;
+
+            if (arg == "-i" && has_value)
+            {
+                opt.images.push_back(argv[++i]);
+            }
+            else if (arg == "-b" && has_value)
+            {
+                opt.baud = parseNumber(argv[++i]);
+            }
+            else if (arg == "-w" && has_value)
+            {
+                opt.window = parseNumber(argv[++i]);
+            }
+            else if (arg == "--repeat" && has_value)
+            {
+                opt.repeat = parseNumber(argv[++i]);
+            }
+            else if (arg == "--transfer-slots" && has_value)
+            {
+                opt.transfer_slots = parseNumber(argv[++i]);
+            }
+            else if (arg == "--emulate" && has_value)
+            {
+                opt.emulate = parseNumber(argv[++i]);
+            }
+            else if (arg == "--chips" && has_value)
+            {
+                opt.chips = parseNumber(argv[++i]);
+            }
+            else if (arg == "--cache" && has_value)
+            {
+                opt.cache = argv[++i];
+            }
+            else if (arg == "--no-cache-fill")
+            {
+                opt.cache_fill = CacheFill::None;
+            }
+            else if (arg == "--serial" && has_value)
+            {
+                const std::string value = argv[++i];
+                const size_t first = value.find(':');
+                const size_t second = first == std::string::npos ? first : value.find(':', first + 1);
+                opt.serial = true;
+                opt.serial_offset = parseNumber(value.substr(0, first));
+                if (first != std::string::npos)
+                {
+                    opt.serial_first = parseNumber(value.substr(first + 1, second - first - 1));
+                }
+                if (second != std::string::npos)
+                {
+                    opt.serial_width = parseNumber(value.substr(second + 1));
+                }
+            }
+            else if (arg[0] == '-')
+            {
+                usage();
+                return 2;
+            }
+            else
+            {
+                opt.ports.push_back(arg);
+            }
+        }
+
+        if (opt.images.empty() || (opt.ports.empty() && !opt.emulate) || opt.serial_width > 4 ||
+            (!opt.cache.empty() && (opt.chips & (opt.chips - 1))))
+        {
+            usage();
+            return 2;
+        }
+
+        std::vector<std::vector<uint8_t>> images;
+        for (const auto& path : opt.images)
+        {
+            images.push_back(loadFile(path));
+            if (images.back().size() > CHIP_SIZE)
+            {
+                throw std::out_of_range(path + " doesn't fit in the chip");
+            }
+            if (opt.serial && opt.serial_offset + opt.serial_width > images.back().size())
+            {
+                throw std::out_of_range("serial number outside of " + path);
+            }
+        }
+
+        std::vector<std::unique_ptr<EmulatorProcess>> emulators;
+        for (unsigned i = 0; i < opt.emulate; i++)
+        {
+            emulators.push_back(std::make_unique<EmulatorProcess>(emulatorProgram(argv[0]), opt.baud,
+                                                                  opt.chips ? highestChip(opt.chips) + 1 : 1));
+            opt.ports.push_back(emulators.back()->path());
+        }
+
+        JobQueue queue;
+        unsigned jobs = 0;
+        for (unsigned r = 0; r < opt.repeat; r++)
+        {
+            for (size_t image = 0; image < images.size(); image++)
+            {
+                queue.push({jobs, image, opt.serial_first + jobs});
+                jobs++;
+            }
+        }
+
+        Slots slots(opt.transfer_slots ? opt.transfer_slots : opt.ports.size());
+        std::vector<BoardStats> stats(opt.ports.size());
+        std::vector<std::thread> workers;
+
+        const auto start = Clock::now();
+        for (size_t i = 0; i < opt.ports.size(); i++)
+        {
+            workers.emplace_back(worker, opt.ports[i], std::cref(opt), std::cref(images), std::ref(queue),
+                                 std::ref(slots), std::ref(stats[i]));
+        }
+        for (auto& w : workers)
+        {
+            w.join();
+        }
+        const double wall = seconds(Clock::now() - start);
+
+        unsigned done = 0, failed = 0, requeued = 0;
+        uint64_t bytes = 0;
+        std::printf("%-16s %5s %6s %9s %8s %8s %8s %8s %9s\n",
+                    "port", "done", "failed", "bytes", "erase_s", "wait_s", "prog_s", "verify_s", "B/s");
+        for (const auto& s : stats)
+        {
+            const double busy = seconds(s.erase + s.program + s.verify);
+            std::printf("%-16s %5u %6u %9llu %8.2f %8.2f %8.2f %8.2f %9.0f%s%s\n", s.port.c_str(), s.done, s.failed,
+                        static_cast<unsigned long long>(s.bytes), seconds(s.erase), seconds(s.wait),
+                        seconds(s.program), seconds(s.verify), busy > 0 ? s.bytes / busy : 0.0,
+                        s.error.empty() ? "" : "  error: ", s.error.c_str());
+            done += s.done;
+            failed += s.failed;
+            requeued += s.requeued;
+            bytes += s.bytes;
+        }
+
+        // jobs requeued after the last board retired never ran to the end
+        std::printf("total: %u of %u jobs done, %u failed (%u requeued), %zu not run, %llu bytes in %.2f s, %.0f B/s aggregate\n",
+                    done, jobs, failed, requeued, queue.left(), static_cast<unsigned long long>(bytes), wall,
+                    wall > 0 ? bytes / wall : 0.0);
+
+        return (done == jobs) ? 0 : 1;
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "sstrack: %s\n", e.what());
+        return 1;
+    }
+}
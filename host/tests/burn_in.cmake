@@ -0,0 +1,23 @@
+# On-device copy and fill against an emulated board, each crc sstflash prints has to match the one
+# worked out from the patterns in protocol.h. Run as the client of sstemu --link PORT:
+#   cmake -DSSTFLASH=... -DPORT=... -P burn_in.cmake
+
+function(expect_crc expected)
+    execute_process(
+        COMMAND ${SSTFLASH} -p ${PORT} -b 115200 ${ARGN}
+        RESULT_VARIABLE result
+        OUTPUT_VARIABLE crc
+        ERROR_VARIABLE log
+        OUTPUT_STRIP_TRAILING_WHITESPACE
+    )
+    if(NOT result EQUAL 0 OR NOT crc STREQUAL expected)
+        string(REPLACE ";" " " command "${ARGN}")
+        message(FATAL_ERROR "sstflash ${command}: '${crc}', expected ${expected}\n${log}")
+    endif()
+endfunction()
+
+# sectors 1 and 2 from the lfsr seeded with 7, sector 1 on its own is 0xfabb
+expect_crc(0x46c6 fill 0x1000 0x2000 random 7)
+expect_crc(0xfabb copy 1 9)
+expect_crc(0x2637 fill 0x3000 0x1000 increment 0x10)
+expect_crc(0x2637 copy 3 10)
@@ -0,0 +1,26 @@
+# Dump IMAGE from an emulated board through line faults and compare the result with IMAGE.
+#   cmake -DSSTEMU=... -DSSTFLASH=... -DIMAGE=... -DOUT=... -P dump_faults.cmake
+# The flip corrupts the first chunk frame, the drop loses the end of the second and all of the
+# third, so chunks are asked for again both after a bad crc and after going missing.
+
+file(READ ${IMAGE} contents HEX)
+string(LENGTH "${contents}" digits)
+math(EXPR length "${digits} / 2")
+
+execute_process(
+    COMMAND ${SSTEMU} -b 115200 --image ${IMAGE} --flip 600 --drop 1500:1100
+        -- ${SSTFLASH} -p {} -b 115200 dump ${OUT} 0 ${length} --restart
+    RESULT_VARIABLE result
+    ERROR_VARIABLE log
+)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "dump failed:\n${log}")
+endif()
+if(NOT log MATCHES " [1-9][0-9]* retransmitted")
+    message(FATAL_ERROR "the faults didn't cost a retransmit:\n${log}")
+endif()
+
+execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${OUT} ${IMAGE} RESULT_VARIABLE differ)
+if(differ)
+    message(FATAL_ERROR "${OUT} differs from ${IMAGE}")
+endif()
@@ -0,0 +1,121 @@
+// Types the firmware's text commands at a pty the way a terminal would and checks the replies.
+// Debug lines ("# ...") and per-byte "OK"s are skipped, what a write took is checked by reading it back.
+//   text_mode PORT, run as the client of sstemu
+#include "serial.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <string>
+
+class Terminal
+{
+public:
+    explicit Terminal(const std::string& path) : port_(path, 115200)
+    {
+        // whatever is left of the banner
+        uint8_t buf[256];
+        while (port_.read(buf, sizeof(buf), 200) > 0)
+        {
+        }
+    }
+
+    void send(const std::string& text)
+    {
+        port_.write(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+    }
+
+    // next line that isn't debug output or an OK, empty after two seconds of nothing
+    std::string line()
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (std::chrono::steady_clock::now() < deadline)
+        {
+            const size_t end = pending_.find('\n');
+            if (end == std::string::npos)
+            {
+                uint8_t buf[256];
+                const size_t n = port_.read(buf, sizeof(buf), 100);
+                pending_.append(reinterpret_cast<const char*>(buf), n);
+                continue;
+            }
+
+            const std::string text = pending_.substr(0, end);
+            pending_.erase(0, end + 1);
+            if (!text.empty() && text[0] != '#' && text != "OK")
+            {
+                return text;
+            }
+        }
+        return "";
+    }
+
+private:
+    SerialPort port_;
+    std::string pending_;
+};
+
+static unsigned failures = 0;
+
+static void expect(Terminal& terminal, const std::string& wanted)
+{
+    const std::string got = terminal.line();
+    if (got != wanted)
+    {
+        std::fprintf(stderr, "expected '%s', got '%s'\n", wanted.c_str(), got.c_str());
+        failures++;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2)
+    {
+        std::fprintf(stderr, "usage: text_mode PORT\n");
+        return 2;
+    }
+
+    try
+    {
+        Terminal terminal(argv[1]);
+
+        // echo is on out of reset
+        terminal.send("q 1\n");
+        expect(terminal, "q 1");
+        expect(terminal, "DONE");
+
+        // one or two digits per byte, a CR LF line end is one token, a rejected token keeps the address
+        terminal.send("w 0 6\n");
+        terminal.send("12\n5\nzz\n123456\n3\r\n4x\n56\nab\ncd\n");
+        expect(terminal, "ERROR");
+        expect(terminal, "ERROR");
+        expect(terminal, "ERROR");
+
+        terminal.send("r 0 0x14\n");
+        expect(terminal, "00000: 12 05 03 56 ab cd ff ff ff ff ff ff ff ff ff ff ;de");
+        expect(terminal, "00010: ff ff ff ff ;fc");
+
+        // missing arguments
+        terminal.send("r 0\n");
+        expect(terminal, "ERROR");
+
+        terminal.send("q 0\n");
+        expect(terminal, "DONE");
+        terminal.send("r 2 2\n");
+        expect(terminal, "r 2 2");
+        expect(terminal, "00002: 03 56 ;59");
+
+        terminal.send("q 1\n");
+        expect(terminal, "q 1");
+        expect(terminal, "DONE");
+        terminal.send("r 4 1\n");
+        expect(terminal, "00004: ab ;ab");
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "text_mode: %s\n", e.what());
+        return 1;
+    }
+
+    return failures ? 1 : 0;
+}
@@ -1,8 +1,11 @@
 #include "atmega.h"
 #include "SST39SF020A.h"
-
-#include <stdlib.h>
-#include <string.h>
+#include "protocol.h"
+#include "batch.h"
+#include "stats.h"
+#include "health.h"
+#include "hexdump.h"
+#include "command.h"
 
 // serial commands
 #define CMD_DUMP 'd'
@@ -12,9 +15,14 @@
 #define CMD_READ_DEVICE_ID 'i'
 #define CMD_READ_MANUFACTURER_ID 'm'
 #define CMD_WRITE 'w'
-
-// delimit arguments in received serial string
-#define DELIMITER ((char)0x20)
+#define CMD_GATHER 'g'
+#define CMD_BATCH 'b'
+#define CMD_STATS 'p'
+#define CMD_STATS_RESET 'z'
+#define CMD_HEALTH 'h'
+#define CMD_CHIP_SELECT 'e'
+#define CMD_ECHO 'q'
+#define CMD_DUMP_CHUNK 'k'
 
 #define MIN(x,  y)   (((x) < (y)) ? (x) : (y))
 
@@ -25,94 +33,228 @@
 // redirect stdout to the serial port
 static FILE uart_stdout = FDEV_SETUP_STREAM(put_char, NULL, _FDEV_SETUP_WRITE);
 
-// function for search for the delimiter in a string
-int findChar(const char* string, uint8_t start)
+// read from eeprom and write to serial port
+void flash_read(const uint32_t start, const uint32_t length)
 {
-    if (start < 0)
+    if (start > ADDR_MASK)
     {
-        return -1;
+        //printf("ERROR\n");
+        return;
     }
 
-    char* cur = (char*)string;
-    cur += start;
+    // prevent this going outside of the maximum address, up to and including ADDR_MASK
+    const uint32_t end = (length > ADDR_MASK + 1 - start) ? ADDR_MASK + 1 : start + length;
+
+    // block reads, one hexdump line each
+    uint8_t buf[HEXDUMP_WIDTH];
 
-    while (cur++)
+    for (uint32_t addr = start; addr < end; addr += sizeof(buf))
     {
-        if (*cur == DELIMITER)
-        {
-            return (cur - string);
-        }
+        const uint8_t chunk = MIN(end - addr, sizeof(buf));
+        SST39SF020A_readBlock(addr, buf, chunk);
+        hex_line(addr, buf, chunk);
     }
-
-    return -1;
-
 }
 
-// read from eeprom and write to serial port
-void flash_read(const uint32_t start, const uint32_t length)
+// read from serial port and write to eeprom
+void flash_write(const uint32_t start, const uint32_t length)
 {
-    if (length > ADDR_MASK || start > ADDR_MASK)
+    if (start > ADDR_MASK)
     {
-        //printf("ERROR\n");
+        //printf("ERROR");
         return;
     }
 
-    uint32_t end = start + length;
+    // prevent this going outside of the maximum address, up to and including ADDR_MASK
+    const uint32_t end = (length > ADDR_MASK + 1 - start) ? ADDR_MASK + 1 : start + length;
+
+    // two hex digits and the terminator, one more in case the terminator is missing
+    char buf[4] = {0};
 
-    // prevent this going outside of the maximum address
-    if (end > ADDR_MASK)
+    #if DEBUG
+    // the digits are filled in per byte
+    char line[] = "# address=0x00000000, write=0x00\n";
+    #else
+    static const char ok[] = "OK\n";
+    #endif
+    static const char error[] = "ERROR\n";
+
+    uint32_t addr = start;
+    while (addr < end)
     {
-        end = ADDR_MASK + 1;
-    }
+        UART_readString(buf, 3);
 
+        if (!buf[0])
+        {
+            continue; // blank, the \n of a \r\n line end
+        }
 
-    for (uint32_t addr = start; addr < end; addr++)
-    {
-        uint8_t data = SST39SF020A_readData(addr);
-        #ifdef DEBUG
-        printf("# address=0x%08lx, read=0x%02x\n", addr, data);
+        // one or two hex digits, anything else is rejected and the same address takes the next token
+        const uint8_t high = hex_nibble(buf[0]);
+        const uint8_t low = buf[1] ? hex_nibble(buf[1]) : 0;
+        if (high == 0xff || low == 0xff || (buf[1] && buf[2]))
+        {
+            if (buf[1] && buf[2])
+            {
+                // drop the rest of the token, anything below a space ends the line as in UART_readString
+                while ((uint8_t)UART_readChar() >= ' ');
+            }
+            UART_write((const uint8_t*)error, sizeof(error) - 1);
+            continue;
+        }
+        const uint8_t data = buf[1] ? (high << 4) | low : high;
+
+        // a byte the chip didn't take is not retried, the address moves on
+        if (!SST39SF020A_writeData(addr++, data))
+        {
+            UART_write((const uint8_t*)error, sizeof(error) - 1);
+            continue;
+        }
+
+        #if DEBUG
+        hex_format(line + 12, addr - 1, 8);
+        hex_format(line + 30, data, 2);
+        UART_write((const uint8_t*)line, sizeof(line) - 1);
         #else
-        printf("%02x\n", data);
-        #endif
+        //print ok to let the computer know this has accepted the byte
+        UART_write((const uint8_t*)ok, sizeof(ok) - 1);
+        #endif // DEBUG
     }
+
 }
 
-// read from serial port and write to eeprom
-void flash_write(const uint32_t start, const uint32_t length)
+
+// scatter-gather read, reply with the merged ranges in a single frame (see protocol.h)
+void flash_gather(const uint32_t count)
 {
-    if (length > ADDR_MASK || start > ADDR_MASK)
+    // more entries than there are bytes on the chip, not a request worth draining
+    if (count > ADDR_MASK + 1)
     {
-        //printf("ERROR");
+        printf("ERROR\n");
         return;
     }
 
-    uint32_t end = start + length;
-    // prevent this going outside of the maximum address
-    if (end > ADDR_MASK)
+    // requested ranges, kept sorted by start address, static so avr-size counts them
+    static struct
     {
-        end = ADDR_MASK + 1;
+        uint32_t start;
+        uint32_t end;
+    } range[GATHER_MAX_ENTRIES];
+    uint8_t ranges = 0;
+
+    uint8_t raw[GATHER_ENTRY_SIZE];
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        UART_read(raw, sizeof(raw));
+
+        const uint32_t start = ((uint32_t)raw[0] << 16) | ((uint16_t)raw[1] << 8) | raw[2];
+        uint32_t end = start + (((uint16_t)raw[3] << 8) | raw[4]);
+
+        if (count > GATHER_MAX_ENTRIES || end == start || start > ADDR_MASK)
+        {
+            continue;
+        }
+
+        // prevent this going outside of the maximum address
+        if (end > ADDR_MASK + 1)
+        {
+            end = ADDR_MASK + 1;
+        }
+
+        // insertion sort, the list is short
+        uint8_t pos = ranges++;
+        while (pos && range[pos - 1].start > start)
+        {
+            range[pos] = range[pos - 1];
+            pos--;
+        }
+        range[pos].start = start;
+        range[pos].end = end;
+    }
+
+    if (count > GATHER_MAX_ENTRIES)
+    {
+        printf("ERROR\n");
+        return;
+    }
+
+    // merge overlapping and adjacent ranges in place, so each run is one sequential read
+    uint8_t runs = 0;
+    for (uint8_t i = 0; i < ranges; i++)
+    {
+        if (runs && range[i].start <= range[runs - 1].end)
+        {
+            if (range[i].end > range[runs - 1].end)
+            {
+                range[runs - 1].end = range[i].end;
+            }
+        }
+        else
+        {
+            range[runs++] = range[i];
+        }
     }
 
-    char buf[3] = {0};
-    unsigned int data = 0;
+    uint8_t buf[32];
+
+    frame_begin(CMD_GATHER);
+    frame_write(&runs, 1);
 
-    for (uint32_t addr = start; addr < end; addr++)
+    for (uint8_t i = 0; i < runs; i++)
     {
-        UART_readString(buf, sizeof(buf)/sizeof(char));
-        buf[2] = 0;
-        //should read two hex digits
-        data = strtoul(buf, NULL, 16);
+        uint32_t addr = range[i].start;
+        uint32_t length = range[i].end - range[i].start;
 
-        SST39SF020A_writeData(addr, data);
+        const uint8_t header[GATHER_RUN_HEADER_SIZE] = {
+            (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)addr,
+            (uint8_t)(length >> 16), (uint8_t)(length >> 8), (uint8_t)length
+        };
+        frame_write(header, sizeof(header));
 
-        #if DEBUG
-        printf("# address=0x%08lx, write=0x%02x\n", addr, (uint8_t)data);
-        #else
-        //print ok to let the computer know this has accepted the byte
-        printf("OK\n");
-        #endif // DEBUG
+        while (length)
+        {
+            const uint8_t chunk = MIN(length, sizeof(buf));
+            SST39SF020A_readBlock(addr, buf, chunk);
+            frame_write(buf, chunk);
+
+            addr += chunk;
+            length -= chunk;
+        }
+    }
+
+    frame_end();
+}
+
+
+// one chunk of a chunked dump in a frame of its own, timed from when the request arrived to the last data byte (see protocol.h)
+void flash_dumpChunk(const uint32_t chunk, const uint32_t arrived)
+{
+    if (chunk >= DUMP_CHUNKS)
+    {
+        printf("ERROR\n");
+        return;
+    }
+
+    const uint8_t number[2] = {(uint8_t)(chunk >> 8), (uint8_t)chunk};
+    uint8_t buf[32];
+    uint32_t addr = chunk * DUMP_CHUNK_SIZE;
+
+    frame_begin(CMD_DUMP_CHUNK);
+    frame_write(number, sizeof(number));
+
+    for (uint16_t left = DUMP_CHUNK_SIZE; left; left -= sizeof(buf))
+    {
+        SST39SF020A_readBlock(addr, buf, sizeof(buf));
+        frame_write(buf, sizeof(buf));
+        addr += sizeof(buf);
     }
 
+    const uint32_t us = timer_ticksToUs(timer_now() - arrived);
+    const uint8_t elapsed[4] = {(uint8_t)(us >> 24), (uint8_t)(us >> 16), (uint8_t)(us >> 8), (uint8_t)us};
+    frame_write(elapsed, sizeof(elapsed));
+
+    frame_end();
 }
 
 
@@ -124,17 +266,18 @@ int main(void)
 
     UART_setup(BAUD);
 
+    timer_init();
+    stats_reset();
+    health_reset();
+
     SST39SF020A_setChipEnable(FALSE);
     SST39SF020A_setOutputEnable(TRUE);
     SST39SF020A_setWriteEnable(FALSE);
 
     delay_us(1); //Recommended System Power-up Timing
 
-    // somewhere to read serial parameters
-    char cmd[32] = {0};
-    char arg[2][16] = {0};
+    struct command cmd;
 
-    int index, index2;
     #if DEBUG
     printf("\n# Welcome!\n");
     #endif // DEBUG
@@ -146,30 +289,48 @@ int main(void)
         printf("# enter command: \n");
         #endif
 
-        memset(cmd, 0, sizeof(cmd));
-        UART_readString(cmd, sizeof(cmd));
+        UART_waitForData();
+        const uint32_t arrived = timer_now(); // the first byte is in, or was already queued
+        command_read(&cmd);
+        STATS_RECORD(STAT_COMMAND, arrived);
 
-        /* command format
+        /* command format, every number is hex (see command.h for the binary header)
         read: r start length\n
         dump: d\n
-        write: w start length\n
+        write: w start [length]\n
         man id: m\n
         dev id: i\n
         sector erase: s sector\n
         full erase: f\n
+        gather read: g count\n + count binary entries
+        chunked dump: k chunk\n
+        batch: b length\n + length bytes of records
+        performance counters: p\n
+        program/erase time report: h\n
+        reset performance counters and program/erase times: z\n
+        chip select: e mask\n (bit n is chip n)
+        echo: q 1\n turns echo off, q 0\n back on
         */
 
-        if (cmd[0] == CMD_DUMP)
+        if (!cmd.op)
+        {
+            continue; // empty line
+        }
+        else if (cmd.error)
+        {
+            printf("ERROR\n");
+        }
+        else if (cmd.op == CMD_DUMP)
         {
             #ifdef DEBUG
             printf("# Dumping chip...\n");
             #endif // DEBUG
-            flash_read(0, ADDR_MASK);
+            flash_read(0, ADDR_MASK + 1);
         }
 
         #ifndef DISABLED
         //Disabled due to faulty implementation
-        else if (cmd[0] == CMD_READ_DEVICE_ID)
+        else if (cmd.op == CMD_READ_DEVICE_ID)
         {
             uint8_t data = SST39SF020A_readDeviceID();
             #if DEBUG
@@ -178,7 +339,7 @@ int main(void)
             printf("%02x\n", data);
             #endif // DEBUG
         }
-        else if (cmd[0] == CMD_READ_MANUFACTURER_ID)
+        else if (cmd.op == CMD_READ_MANUFACTURER_ID)
         {
             uint8_t data = SST39SF020A_readManufacturerID();
             #if DEBUG
@@ -189,109 +350,107 @@ int main(void)
         }
         #endif
 
-        else if (cmd[0] == CMD_FULL_ERASE)
+        else if (cmd.op == CMD_STATS)
+        {
+            stats_report();
+        }
+        else if (cmd.op == CMD_STATS_RESET)
+        {
+            stats_reset();
+            health_reset();
+            printf("DONE\n");
+        }
+        else if (cmd.op == CMD_HEALTH)
+        {
+            health_report();
+        }
+        else if (cmd.op == CMD_FULL_ERASE)
         {
             #ifdef DEBUG
             printf("# Erasing chip...\n");
             #endif // DEBUG
-            SST39SF020A_chipErase();
-            #ifdef DEBUG
-            printf("DONE\n");
-            #endif
+            if (SST39SF020A_chipErase())
+            {
+                #ifdef DEBUG
+                printf("DONE\n");
+                #endif
+            }
+            else
+            {
+                printf("ERROR\n");
+            }
         }
-        else
+        else if (cmd.op == CMD_RANDOM_READ && cmd.args == 2)
         {
-            //commands that require arguments
+            #if DEBUG
+            printf("# random read\n");
+            printf("# addr=0x%lx, len=0x%lx\n", cmd.arg[0], cmd.arg[1]);
+            #endif
 
-            memset(arg, 0, sizeof(arg));
+            flash_read(cmd.arg[0], cmd.arg[1]);
+        }
+        else if (cmd.op == CMD_SECTOR_ERASE && cmd.args >= 1)
+        {
+            #ifdef DEBUG
+            printf("# Erasing sector %lx...\n", cmd.arg[0]);
+            #endif // DEBUG
 
-            index = findChar(cmd, 0);
-            if (index < 0)
+            if (cmd.arg[0] < SST39SF020A_NUMSECTORS && SST39SF020A_sectorErase((uint8_t)cmd.arg[0]))
             {
-                continue;
+                printf("DONE\n"); //success code
             }
-
-            index++; // jump over the space char
-
-            index2 = findChar(cmd, index);
-            index2++; // jump over the space char
-
-            strncpy(arg[0], cmd + index, MIN(index2 - index, sizeof(arg[0])));
-
-            strncpy(arg[1], cmd + index2, MIN(strlen(cmd) - index2, sizeof(arg[1])));
-
-            if (cmd[0] == CMD_RANDOM_READ)
+            else
             {
-                #if DEBUG
-                printf("# random read\n");
-                #endif
-
-                if (!index2)
-                {
-                    continue;
-                }
-
-                uint32_t addr = 0;
-                addr = strtoul(arg[0], NULL, 16);
-
-                uint32_t length = 0;
-                length = strtoul(arg[1], NULL, 10);
-
-                #if DEBUG
-                printf("# addr=0x%lx, len=0x%lx\n", addr, length);
-                #endif
-
-                flash_read(addr, length);
+               printf("ERROR\n"); //success code
             }
-            else if (cmd[0] == CMD_SECTOR_ERASE)
+        }
+        else if (cmd.op == CMD_CHIP_SELECT && cmd.args >= 1)
+        {
+            if (cmd.arg[0] <= 0xff && SST39SF020A_select((uint8_t)cmd.arg[0]))
             {
-                unsigned int sector = 0;
-                sector = strtoul(arg[0], NULL, 10);
-
-                #ifdef DEBUG
-                printf("# Erasing sector %u...\n", sector);
-                #endif // DEBUG
-
-                if (sector < SST39SF020A_NUMSECTORS)
-                {
-                    SST39SF020A_sectorErase((uint8_t)sector);
-                    printf("DONE\n"); //success code
-                }
-                else
-                {
-                   printf("ERROR\n"); //success code
-                }
+                printf("DONE\n");
             }
-            else if (cmd[0] == CMD_WRITE)
+            else
             {
-                uint32_t addr = 0;
-                uint32_t length = 0;
-
-                #if DEBUG
-                printf("# write mode\n");
-                #endif // DEBUG
-
-                if (!index2 || !strlen(arg[1]))
-                {
-                    length = ADDR_MASK;
-                }
-                else
-                {
-                    length = strtoul(arg[1], NULL, 16);
-                }
-
-                addr = strtoul(arg[0], NULL, 16);
-
-
-                #if DEBUG
-                printf("# addr=0x%lx, len=0x%lx\n", addr, length);
-                #endif
-
-                flash_write(addr, length);
+                printf("ERROR\n");
             }
+        }
+        else if (cmd.op == CMD_ECHO && cmd.args >= 1)
+        {
+            UART_setEcho(!cmd.arg[0]);
+            printf("DONE\n");
+        }
+        else if (cmd.op == CMD_GATHER && cmd.args >= 1)
+        {
+            #if DEBUG
+            printf("# gather %lx ranges\n", cmd.arg[0]);
+            #endif // DEBUG
+
+            flash_gather(cmd.arg[0]);
+        }
+        else if (cmd.op == CMD_DUMP_CHUNK && cmd.args >= 1)
+        {
+            flash_dumpChunk(cmd.arg[0], arrived);
+        }
+        else if (cmd.op == CMD_BATCH && cmd.args >= 1)
+        {
+            batch_run(cmd.arg[0]);
+        }
+        else if (cmd.op == CMD_WRITE && cmd.args >= 1)
+        {
+            const uint32_t addr = cmd.arg[0];
+            const uint32_t length = (cmd.args == 2) ? cmd.arg[1] : ADDR_MASK + 1;
 
+            #if DEBUG
+            printf("# write mode\n");
+            printf("# addr=0x%lx, len=0x%lx\n", addr, length);
+            #endif
 
+            flash_write(addr, length);
+        }
+        else
+        {
+            printf("ERROR\n");
         }
     }
 }
-
@@ -0,0 +1,39 @@
+#include "protocol.h"
+#include "atmega.h"
+
+#include <util/crc16.h>
+
+// running checksum of the frame being sent
+static uint16_t frame_crc;
+
+void frame_begin(uint8_t type)
+{
+    const uint8_t start = FRAME_START;
+    UART_write(&start, 1);
+
+    frame_crc = FRAME_CRC_INIT;
+    frame_write(&type, 1);
+}
+
+void frame_write(const uint8_t* buf, uint16_t length)
+{
+    frame_crc = crc_update(frame_crc, buf, length);
+
+    UART_write(buf, length);
+}
+
+void frame_end(void)
+{
+    const uint8_t crc[2] = {(uint8_t)(frame_crc >> 8), (uint8_t)frame_crc};
+    UART_write(crc, sizeof(crc));
+}
+
+uint16_t crc_update(uint16_t crc, const uint8_t* buf, uint16_t length)
+{
+    while (length--)
+    {
+        crc = _crc_ccitt_update(crc, *buf++);
+    }
+
+    return crc;
+}
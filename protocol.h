@@ -0,0 +1,69 @@
+#ifndef PROTOCOL_H_INCLUDED
+#define PROTOCOL_H_INCLUDED
+
+#include <stdint.h>
+
+/* Binary replies are framed so a host can find them between echoed and debug text:
+    FRAME_START, type, payload..., crc16 high, crc16 low
+   type is the command character that produced the frame.
+   The crc is CRC-16/MCRF4XX (avr-libc _crc_ccitt_update, start 0xffff) over type and payload. */
+#define FRAME_START ((uint8_t)0x02)
+#define FRAME_CRC_INIT 0xffff
+
+/* Commands are text lines, "c [arg0 [arg1]]\n" with hex arguments, echoed back unless echo is off.
+   Machine clients can skip the text instead and send a fixed header, which is never echoed:
+    COMMAND_START, command, arg0 (3 bytes, big endian), arg1 (3 bytes, big endian)
+   followed by the command's binary payload if it has one. */
+#define COMMAND_START ((uint8_t)0x01)
+#define COMMAND_HEADER_SIZE 8
+
+/* Scatter-gather read: "g count\n" (or its header) followed by count entries of
+    address (3 bytes, big endian), length (2 bytes, big endian)
+   Entries are sorted and merged on the device, the reply payload is
+    number of runs (1 byte), then per run: address (3 bytes), length (3 bytes), data */
+#define GATHER_ENTRY_SIZE 5
+#define GATHER_RUN_HEADER_SIZE 6
+#define GATHER_MAX_ENTRIES 16 // 8 bytes of SRAM each
+
+/* Chunked dump: "k chunk\n" reads DUMP_CHUNK_SIZE bytes from chunk * DUMP_CHUNK_SIZE, DUMP_CHUNKS cover the chip.
+   The reply payload is chunk (2 bytes, big endian), data, then the time the device spent on the chunk
+   in microseconds (4 bytes, big endian), from the main loop picking up the request's first byte to the
+   last data byte handed to the UART, so receiving and parsing the request count too.
+   A corrupt or lost chunk is asked for again on its own. */
+#define DUMP_CHUNK_SIZE 1024
+#define DUMP_CHUNKS 256
+
+/* Batch: "b length\n" (or its header) followed by length bytes of records, each run as soon as it has arrived
+    'f'                                         chip erase
+    's' sector (1 byte)                         sector erase
+    'w' address (3 bytes) length (2 bytes) data program, 0xff bytes are skipped
+    'c' address (3 bytes) length (3 bytes)      crc16 of a range
+    'e' chips (1 byte)                          select chips by mask, see SST39SF020A_select
+    'y' source (1 byte) destination (1 byte)    copy a sector, value is the crc of the copy
+    't' address (3 bytes) length (3 bytes) pattern (1 byte) seed (1 byte)
+                                                fill with a FILL_* pattern, value is the crc read back
+   Like 'w', copy and fill only program, the destination must have been erased. Both read the result back
+   and report BATCH_STATUS_ERROR if its crc differs from the data that was written.
+   The reply frame has one result per record: op (1 byte), status (1 byte), value (2 bytes, big endian, crc for 'c')
+   and ends with a BATCH_END result whose value is the number of records run.
+   A malformed record gets BATCH_STATUS_ERROR and stops the batch. A program or erase that a selected chip
+   doesn't finish in time (SST_*_TIMEOUT_US) gets BATCH_STATUS_ERROR too, the batch carries on.
+   A whole batch fits the firmware's receive buffer (USE_ISR), so nothing is lost while a record runs. */
+#define BATCH_MAX_SIZE 255
+#define BATCH_RESULT_SIZE 4
+#define BATCH_END ((uint8_t)0x00)
+#define BATCH_STATUS_OK ((uint8_t)0x00)
+#define BATCH_STATUS_ERROR ((uint8_t)0x01)
+
+// fill patterns, byte n of the range is
+#define FILL_CONSTANT 0 // seed
+#define FILL_INCREMENT 1 // seed + n
+#define FILL_RANDOM 2 // low byte of a 16 bit Galois LFSR (taps 0xb400) started at 0xff00 | seed, stepped before each byte
+
+void frame_begin(uint8_t type);
+void frame_write(const uint8_t* buf, uint16_t length);
+void frame_end(void);
+
+uint16_t crc_update(uint16_t crc, const uint8_t* buf, uint16_t length);
+
+#endif // PROTOCOL_H_INCLUDED
@@ -0,0 +1,95 @@
+#include "stats.h"
+#include "atmega.h"
+
+struct stat
+{
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint16_t total; // ticks short of a whole millisecond
+    uint32_t total_ms; // the rest of the total, ticks alone would wrap after 48 minutes
+};
+
+#define TICKS_PER_MS ((F_CPU) / 1000UL / TIMER_PRESCALER)
+
+static struct stat stats[STAT_COUNT];
+
+static const char* const stat_name[STAT_COUNT] = {
+    "read",
+    "program",
+    "data_poll",
+    "toggle_bit",
+    "sector_erase",
+    "chip_erase",
+    "uart_tx",
+    "uart_rx",
+    "command"
+};
+
+void stats_reset(void)
+{
+    for (uint8_t i = 0; i < STAT_COUNT; i++)
+    {
+        stats[i].count = 0;
+        stats[i].min = UINT32_MAX;
+        stats[i].max = 0;
+        stats[i].total = 0;
+        stats[i].total_ms = 0;
+    }
+}
+
+// add the time from start until now to a counter
+void stats_record(uint8_t id, uint32_t start)
+{
+    const uint32_t elapsed = timer_now() - start;
+    struct stat* s = &stats[id];
+
+    s->count++;
+
+    // whole milliseconds straight into total_ms, only long operations pay for the divide
+    uint16_t ticks = elapsed;
+    if (elapsed >= TICKS_PER_MS)
+    {
+        s->total_ms += elapsed / TICKS_PER_MS;
+        ticks = elapsed % TICKS_PER_MS;
+    }
+    s->total += ticks;
+    if (s->total >= TICKS_PER_MS)
+    {
+        s->total -= TICKS_PER_MS;
+        s->total_ms++;
+    }
+
+    if (elapsed < s->min)
+    {
+        s->min = elapsed;
+    }
+    if (elapsed > s->max)
+    {
+        s->max = elapsed;
+    }
+}
+
+/* one line per operation: name count min max total, times in us
+   printing records UART stalls too, so each counter is copied before it is printed */
+void stats_report(void)
+{
+    for (uint8_t i = 0; i < STAT_COUNT; i++)
+    {
+        const struct stat s = stats[i];
+
+        printf("%s %lu %lu %lu ", stat_name[i], s.count, s.count ? timer_ticksToUs(s.min) : 0, timer_ticksToUs(s.max));
+
+        // the total in us can pass 32 bits, print it as seconds and the microseconds after them
+        const uint32_t us = (s.total_ms % 1000) * 1000 + timer_ticksToUs(s.total);
+        if (s.total_ms >= 1000)
+        {
+            printf("%lu%06lu\n", s.total_ms / 1000, us);
+        }
+        else
+        {
+            printf("%lu\n", us);
+        }
+    }
+    printf("DONE\n");
+}
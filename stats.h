@@ -0,0 +1,34 @@
+#ifndef STATS_H_INCLUDED
+#define STATS_H_INCLUDED
+
+#include "atmega.h"
+
+// Operations that are timed, reported in this order
+enum STAT_ID
+{
+    STAT_READ = 0, // readData/readBlock calls
+    STAT_PROGRAM, // whole byte program, including the poll
+    STAT_DATA_POLL, // waitForDataPoll
+    STAT_TOGGLE_BIT, // waitForToggleBit
+    STAT_SECTOR_ERASE,
+    STAT_CHIP_ERASE,
+    STAT_UART_TX, // waiting for an empty transmit buffer
+    STAT_UART_RX, // waiting for received data, not counting the wait for a new command
+    STAT_COMMAND, // receiving and parsing a command, from its first byte, stalls also count in uart_rx
+    STAT_COUNT
+};
+
+void stats_reset(void);
+void stats_record(uint8_t id, uint32_t start);
+void stats_report(void);
+
+// Build with -DDISABLE_STATS to compile the instrumentation out
+#ifndef DISABLE_STATS
+#define STATS_START(t) const uint32_t t = timer_now()
+#define STATS_RECORD(id, t) stats_record((id), (t))
+#else
+#define STATS_START(t)
+#define STATS_RECORD(id, t)
+#endif
+
+#endif // STATS_H_INCLUDED